@@ -2,14 +2,29 @@
  * linebolt.c — A high-performance source line counter
  *
  * Traverses the current directory and all subdirectories (non-recursively),
- * counts the number of lines in `.c` and `.h` source files, and prints the
- * result along with per-file line counts. It skips common build or VCS
- * directories like `.git`, `bin`, and `build`.
+ * counts the number of lines in source files (`.c` and `.h` unless `--ext`
+ * says otherwise), and prints the result along with per-file line counts.
+ * It skips common build or VCS directories like `.git`, `bin`, and `build`,
+ * plus any matching an `--exclude-dir` glob (and, with `--gitignore`,
+ * anything git would ignore).
  *
- * Implements a non-recursive depth-first search using a global stack.
+ * Implements a non-recursive depth-first search spread over worker threads,
+ * each with its own deque of pending directories; idle workers steal work.
+ * Inside a git checkout, `--git-index` reads the tracked file list from
+ * `.git/index` instead of walking the directories at all.
+ * `--rev` counts any commit straight from the git object store.
+ * `--history` reports per-commit totals over a range of commits.
+ * `--classify` splits counts into code, comment and blank lines, using the
+ * comment and string syntax of the language each extension belongs to.
+ * `--by-ext` / `--by-lang` add per-extension or per-language totals.
+ * `--dirs` reports recursive totals per directory as subtrees complete.
  * Designed for POSIX-compliant systems (Linux, macOS).
  *
- * Uses only standard C system functions: `opendir`, `readdir`, `stat`, etc.
+ * Uses only standard C system functions: `opendir`, `readdir`, `fstatat`, etc.
+ * Entry types come from `d_type`; metadata is only fetched when the
+ * filesystem leaves it unknown or the entry is a symbolic link.
+ * Newlines are counted a block at a time with SSE2/AVX2/AVX-512BW kernels
+ * selected at startup for the running CPU.
  *
  * Author: Zülfü Serhat Kük
  * Github: https://github.com/RealSeroMan
@@ -18,12 +33,18 @@
  */
 
 
-// Standard I/O library for printf(), fopen(), etc.
+// Expose sched_getaffinity()/CPU_COUNT and other GNU/POSIX extensions
+#define _GNU_SOURCE
+
+// Standard I/O library for printf(), fprintf(), etc.
 #include <stdio.h>
 
 // For malloc(), free(), exit(), etc.
 #include <stdlib.h>
 
+// For fixed-width integers such as uint64_t and uintptr_t
+#include <stdint.h>
+
 // For string manipulation functions like strlen(), strcmp()
 #include <string.h>
 
@@ -33,7 +54,7 @@
 // For file metadata and file type macros like stat(), S_ISDIR(), S_ISREG()
 #include <sys/stat.h>
 
-// For system-defined path length limits (e.g., PATH_MAX)
+// For system-defined path length limits (e.g., PATH_MAX, NAME_MAX)
 #include <limits.h>
 
 // For error reporting (used with perror())
@@ -42,181 +63,7046 @@
 // Required for clock_gettime()
 #include <time.h>
 
+// For open() and its O_* flags
+#include <fcntl.h>
+
+// For read(), pread(), close()
+#include <unistd.h>
+
+// For writev() and struct iovec
+#include <sys/uio.h>
+
+// For mmap(), madvise(), munmap()
+#include <sys/mman.h>
+
+// For getrlimit()/setrlimit() on the open file limit
+#include <sys/resource.h>
+
+// Worker threads for the parallel traversal
+#include <pthread.h>
+
+// For sched_yield() and, on Linux, sched_getaffinity()
+#include <sched.h>
+
+// Raw syscall numbers for getdents64() and io_uring (Linux only)
+#ifdef __linux__
+#include <sys/syscall.h>
+#ifdef SYS_getdents64
+#define LINEBOLT_HAVE_GETDENTS 1
+#endif
+#endif
+
+// io_uring ABI for the --io=uring backend (Linux only)
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define LINEBOLT_HAVE_URING 1
+#endif
+#endif
+
+// zlib inflates git objects for --rev and --history (link with -lz)
+#if defined(__has_include)
+#if __has_include(<zlib.h>)
+#include <zlib.h>
+#define LINEBOLT_HAVE_ZLIB 1
+#endif
+#endif
+
+// SIMD intrinsics for the vectorized newline counters (x86 only)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define LINEBOLT_X86_SIMD 1
+#endif
+
+// Initial size of path buffers; they grow for deeper paths
 #define MAX_PATH_SIZE PATH_MAX
-#define STACK_SIZE 200000
 
-typedef struct {
-    char path[MAX_PATH_SIZE];
-} StackEntry;
+// Initial capacity of each worker's directory deque (it grows as needed)
+#define DEQUE_INITIAL_CAPACITY 256
+
+// Size of each block a worker carves directory nodes out of
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+// Per-thread buffer for raw getdents64() batches; one call fills it with
+// a few thousand entries
+#define DIRENT_BUFFER_SIZE (256 * 1024)
+
+// Per-thread buffer of formatted result lines, written out with writev()
+#define OUTPUT_BUFFER_SIZE (256 * 1024)
+
+// Records per cache file slot are kept at most half full
+#define CACHE_MIN_CAPACITY 1024
+
+// Buckets of the entries-per-directory histogram (powers of two) and the
+// number of largest directories listed by --stats
+#define DIR_HISTOGRAM_BUCKETS 24
+#define STATS_TOP_DIRS 5
+
+// Size of the block handed to the newline kernel per read() call
+#define READ_BUFFER_SIZE (256 * 1024)
+
+// Files smaller than this are pread() in one go instead of mapped (--io=mmap)
+#define DEFAULT_MMAP_THRESHOLD (64 * 1024)
+
+// Files kept in flight at once by the io_uring backend, each owning one
+// registered buffer of URING_BUFFER_SIZE bytes
+#define URING_SLOTS 64
+#define URING_BUFFER_SIZE (64 * 1024)
+
+// How file contents are brought into memory for counting (--io=...)
+enum io_mode {
+    IO_READ,   // read() into a reused block buffer (default)
+    IO_MMAP,   // map the file read-only and scan the mapping in place
+    IO_URING   // batched openat/read/close through io_uring (Linux)
+};
+
+// Per-group totals printed before the grand total (--by-ext, --by-lang)
+enum breakdown {
+    BREAKDOWN_NONE,
+    BREAKDOWN_EXT,   // One row per --ext extension
+    BREAKDOWN_LANG   // One row per language, merging its extensions
+};
 
 // Declare time structs to capture start and end timestamps
 struct timespec start, end;
 
-static StackEntry stack[STACK_SIZE];
-static int top = 0;
+// Command-line settings
+static enum io_mode io_mode = IO_READ;
+static size_t mmap_threshold = DEFAULT_MMAP_THRESHOLD;
+static int thread_count = 0;  // -j; 0 means one per usable CPU
+static int show_stats = 0;    // --stats
+static enum breakdown breakdown = BREAKDOWN_NONE;  // --by-ext / --by-lang
+static int dir_rollups = 0;   // --dirs
+static int max_depth = -1;    // --depth; -1 shows every directory
+static const char *cache_path = NULL;  // --cache=FILE
+
+
+// ---------------------------------------------------------------------------
+// Extension matching (--ext)
+//
+// The extension list is compiled once into a trie of the extensions spelled
+// backwards, over a byte-class alphabet holding only the characters that
+// occur in some extension. A file name is matched by walking it from the
+// end, so the cost is the length of the longest matching suffix, however
+// many extensions there are. Multi-dot suffixes such as "d.ts" are ordinary
+// paths through the trie; the longest suffix that matches wins.
+// ---------------------------------------------------------------------------
+
+#define DEFAULT_EXTENSIONS "c,h"
+
+typedef struct {
+    int32_t *next;                  // nodes x classes; 0 = no child (root is 0)
+    int32_t *ext_at;                // Per node: extension ending here, or -1
+    unsigned char byte_class[256];  // 0 for bytes no extension contains
+    int classes;
+    int nodes;
+    char **names;                   // Extensions without the leading dot
+    int count;
+} ExtMatcher;
+
+static ExtMatcher ext_matcher;
+
+
+// Returns the index of the extension 'filename' ends with, or -1
+// As before, the name must have something in front of the dot (".c" alone
+// is not a C file)
+int match_extension(const char *filename) {
+    const ExtMatcher *m = &ext_matcher;
+    size_t i = strlen(filename);
+    int node = 0, found = -1;
 
+    while (i > 1) {
+        unsigned char c = (unsigned char)filename[--i];
+        if (c == '.' && m->ext_at[node] >= 0) found = m->ext_at[node];
+        int cls = m->byte_class[c];
+        if (!cls) break;
+        node = m->next[node * m->classes + cls];
+        if (!node) break;
+    }
+    return found;
+}
+
+
+// Compiles a comma-separated extension list ("c,h,cpp,.d.ts") into the
+// global matcher; returns 0 on success, -1 after printing a diagnostic
+int compile_extensions(const char *list) {
+    ExtMatcher *m = &ext_matcher;
+    char *copy = strdup(list);
+    if (!copy) return -1;
+
+    // Collect the distinct extensions; a leading dot is optional
+    size_t max = 1;
+    for (const char *p = list; *p; p++) max += *p == ',';
+    m->names = calloc(max, sizeof(*m->names));
+    if (!m->names) return -1;
+    size_t total_len = 0;
+    for (char *tok = strtok(copy, ","); tok; tok = strtok(NULL, ",")) {
+        if (*tok == '.') tok++;
+        if (*tok == '\0') continue;
+        int dup = 0;
+        for (int i = 0; i < m->count; i++) dup |= strcmp(m->names[i], tok) == 0;
+        if (dup) continue;
+        m->names[m->count++] = tok;
+        total_len += strlen(tok);
+    }
+    if (m->count == 0) {
+        fprintf(stderr, "linebolt: --ext needs at least one extension\n");
+        return -1;
+    }
 
-// Determines whether the file should be counted based on its extension
-// Only .c and .h files are considered valid source files here
-int should_count_file(const char *filename) {
-    size_t len = strlen(filename);
-    if (len > 2 && strcmp(filename + len - 2, ".c") == 0) return 1;
-    if (len > 2 && strcmp(filename + len - 2, ".h") == 0) return 1;
+    // Alphabet: one class per distinct byte used (class 0 means "none")
+    memset(m->byte_class, 0, sizeof(m->byte_class));
+    m->classes = 1;
+    for (int i = 0; i < m->count; i++)
+        for (const unsigned char *p = (const unsigned char *)m->names[i]; *p; p++)
+            if (!m->byte_class[*p]) m->byte_class[*p] = (unsigned char)m->classes++;
+
+    // Worst case every character gets its own node
+    size_t max_nodes = total_len + 1;
+    m->next = calloc(max_nodes * (size_t)m->classes, sizeof(*m->next));
+    m->ext_at = malloc(max_nodes * sizeof(*m->ext_at));
+    if (!m->next || !m->ext_at) return -1;
+    for (size_t n = 0; n < max_nodes; n++) m->ext_at[n] = -1;
+    m->nodes = 1;
+
+    // Insert each extension from its last character to its first
+    for (int i = 0; i < m->count; i++) {
+        const char *name = m->names[i];
+        int node = 0;
+        for (size_t k = strlen(name); k > 0; k--) {
+            int32_t *slot = &m->next[node * m->classes + m->byte_class[(unsigned char)name[k - 1]]];
+            if (!*slot) *slot = m->nodes++;
+            node = *slot;
+        }
+        m->ext_at[node] = i;
+    }
     return 0;
 }
 
 
-// Determines whether a directory should be skipped during traversal
-// Common build or version-control directories are excluded
-int should_ignore_dir(const char *dirname) {
-    return (
-        strcmp(dirname, ".git") == 0 ||    // Git metadata directory
-        strcmp(dirname, ".svn") == 0 ||    // Subversion metadata directory
-        strcmp(dirname, "build") == 0 ||   // Common build output folder
-        strcmp(dirname, "bin") == 0 ||     // Common binary output folder
-        strcmp(dirname, ".vscode") == 0 || // VSCode config folder
-        strcmp(dirname, "obj") == 0        // Common object file folder
-    );
+// ---------------------------------------------------------------------------
+// Glob patterns
+//
+// A set of glob patterns is compiled into one DFA that matches relative
+// paths ("src/gen"). Each pattern first becomes a chain of NFA positions;
+// the chains are then merged by subset construction over byte classes, so
+// matching costs one table lookup per path byte no matter how many patterns
+// there are. Because a path is consumed left to right, a directory can keep
+// the DFA state reached after its own path and hand it to its children,
+// which only have to feed their own names.
+//
+// Syntax (as in .gitignore): '*' and '?' never match '/', "[a-z]" / "[!a-z]"
+// are classes, '\' escapes, a leading "**/" or a middle "/**/" matches any
+// number of directories, a trailing "/**" matches everything inside. A
+// pattern without a '/' (other than a trailing one) matches a name at any
+// depth; one with a '/' is anchored at the top directory.
+// ---------------------------------------------------------------------------
+
+#define GLOB_DEAD 0   // No pattern can match any more
+#define GLOB_START 1  // Nothing consumed yet
+
+// Upper bound on DFA states, to fail loudly on pathological pattern sets
+#define GLOB_MAX_STATES 65536
+
+// One NFA position: the bytes that keep the match here, the bytes that
+// advance it to the next position, and an optional input-free jump
+typedef struct {
+    uint64_t loop[4];
+    uint64_t adv[4];
+    int eps;        // Position reachable without consuming input, or -1
+    int accept_id;  // Pattern id if this ends a pattern, else -1
+    int dir_only;   // The pattern ended in '/' and only matches directories
+} GlobPos;
+
+typedef struct {
+    GlobPos *pos;
+    int npos, cap;
+    int *starts;    // First position of every pattern
+    int nstarts, starts_cap;
+} GlobNfa;
+
+typedef struct {
+    int32_t *next;                  // states x classes
+    int32_t *accept;                // Per state: highest pattern id matched, or -1
+    int32_t *accept_file;           // Same, leaving out directory-only patterns
+    unsigned char byte_class[256];
+    int classes;
+    int states;
+} GlobDfa;
+
+
+// Bit helpers for the 256-bit byte sets
+#define BYTESET_HAS(set, b) (((set)[(b) >> 6] >> ((b) & 63)) & 1)
+#define BYTESET_ADD(set, b) ((set)[(b) >> 6] |= 1ULL << ((b) & 63))
+
+// Appends an empty position and returns its index
+int glob_new_pos(GlobNfa *nfa) {
+    if (nfa->npos == nfa->cap) {
+        int cap = nfa->cap ? nfa->cap * 2 : 64;
+        GlobPos *pos = realloc(nfa->pos, (size_t)cap * sizeof(*pos));
+        if (!pos) {
+            perror("realloc");
+            exit(1);
+        }
+        nfa->pos = pos;
+        nfa->cap = cap;
+    }
+    GlobPos *p = &nfa->pos[nfa->npos];
+    memset(p, 0, sizeof(*p));
+    p->eps = -1;
+    p->accept_id = -1;
+    return nfa->npos++;
 }
 
 
-// Opens a text file and counts how many newline characters it contains
-// This is used to determine the number of lines in a .c or .h file
-long count_lines_in_file(const char *filepath) {
-    FILE *f = fopen(filepath, "r"); // Open the file in read mode
-    if (!f) {
-        perror(filepath);   // Print an error message if opening fails
-        return 0;             // Return 0 lines if file couldn't be opened
+// Fills 'set' with every byte except '/'
+void byteset_not_slash(uint64_t set[4]) {
+    set[0] = set[1] = set[2] = set[3] = ~0ULL;
+    set['/' >> 6] &= ~(1ULL << ('/' & 63));
+}
+
+
+// Emits the two positions of a leading or middle "**/": either nothing, or
+// any run of bytes ending in '/'
+void glob_emit_any_dirs(GlobNfa *nfa) {
+    int first = glob_new_pos(nfa);
+    int second = glob_new_pos(nfa);
+    GlobPos *a = &nfa->pos[first], *b = &nfa->pos[second];
+    memset(a->adv, 0xff, sizeof(a->adv));   // Any byte starts the run...
+    a->eps = second + 1;                    // ...or skip it entirely
+    memset(b->loop, 0xff, sizeof(b->loop)); // The run continues
+    BYTESET_ADD(b->adv, '/');               // and ends at a '/'
+}
+
+
+// Parses a "[...]" class starting at 'p' (just past the '[')
+// Returns the position after the ']', or NULL if the class is unterminated
+const char *glob_parse_class(const char *p, uint64_t set[4]) {
+    int negate = *p == '!' || *p == '^';
+    if (negate) p++;
+    uint64_t members[4] = {0, 0, 0, 0};
+    const char *start = p;
+    while (*p && (*p != ']' || p == start)) {
+        unsigned char lo = (unsigned char)*p, hi = lo;
+        if (*p == '\\' && p[1]) lo = hi = (unsigned char)*++p;
+        if (p[1] == '-' && p[2] && p[2] != ']') {
+            hi = (unsigned char)p[2];
+            p += 2;
+        }
+        for (unsigned c = lo; c <= hi; c++) BYTESET_ADD(members, c);
+        p++;
     }
+    if (*p != ']') return NULL;
 
-    long lines = 0;
-    int ch;
-    int has_content = 0;            // Whether file has at least 1 non-empty char
-    int last_char_was_newline = 0;  // Track if last char is a newline
+    for (int i = 0; i < 4; i++) set[i] = negate ? ~members[i] : members[i];
+    set['/' >> 6] &= ~(1ULL << ('/' & 63));  // Classes never match '/'
+    return p + 1;
+}
 
-    while ((ch = fgetc(f)) != EOF) {
-        has_content = 1;            // File is not empty
-        if (ch == '\n') {
-            lines++;
-            last_char_was_newline = 1;
-        } else {
-            last_char_was_newline = 0;
+
+// Adds one pattern to the NFA under 'id'; a trailing '/' restricts it to
+// directories (see GlobDfa.accept_file)
+void glob_add(GlobNfa *nfa, const char *pattern, int id) {
+    size_t len = strlen(pattern);
+    int dir_only = len > 1 && pattern[len - 1] == '/';
+    while (len > 1 && pattern[len - 1] == '/') len--;
+
+    // A '/' anywhere but at the end anchors the pattern at the top
+    int anchored = memchr(pattern, '/', len) != NULL;
+    const char *p = pattern, *end = pattern + len;
+    if (*p == '/') p++;
+
+    if (nfa->nstarts == nfa->starts_cap) {
+        int cap = nfa->starts_cap ? nfa->starts_cap * 2 : 16;
+        int *starts = realloc(nfa->starts, (size_t)cap * sizeof(*starts));
+        if (!starts) {
+            perror("realloc");
+            exit(1);
         }
+        nfa->starts = starts;
+        nfa->starts_cap = cap;
     }
+    nfa->starts[nfa->nstarts++] = nfa->npos;
 
-    fclose(f);  // MUST close the file
+    if (!anchored) glob_emit_any_dirs(nfa);
 
-    // If file has content but does not end in newline, count the last line
-    if (has_content && !last_char_was_newline)
-        lines++;
+    while (p < end) {
+        int at_component_start = p == pattern || p[-1] == '/';
+
+        if (at_component_start && p[0] == '*' && p[1] == '*' && (p + 2 == end || p[2] == '/')) {
+            if (p + 2 == end) {
+                // Trailing "**": at least one more byte, then anything
+                int first = glob_new_pos(nfa);
+                memset(nfa->pos[first].adv, 0xff, sizeof(nfa->pos[first].adv));
+                int second = glob_new_pos(nfa);
+                memset(nfa->pos[second].loop, 0xff, sizeof(nfa->pos[second].loop));
+                nfa->pos[second].eps = second + 1;
+                p += 2;
+            } else {
+                glob_emit_any_dirs(nfa);
+                p += 3;
+            }
+            continue;
+        }
+
+        int at = glob_new_pos(nfa);
+        GlobPos *pos = &nfa->pos[at];
+        if (*p == '*') {
+            while (p < end && *p == '*') p++;
+            byteset_not_slash(pos->loop);
+            pos->eps = at + 1;
+        } else if (*p == '?') {
+            byteset_not_slash(pos->adv);
+            p++;
+        } else if (*p == '[' && glob_parse_class(p + 1, pos->adv)) {
+            p = glob_parse_class(p + 1, pos->adv);
+        } else {
+            // Plain byte; an unterminated '[' is taken literally too
+            const char *lit = p;
+            if (*lit == '\\' && lit + 1 < end) lit++;
+            BYTESET_ADD(pos->adv, (unsigned char)*lit);
+            p = lit + 1;
+        }
+    }
 
-    return lines;
+    int last = glob_new_pos(nfa);
+    nfa->pos[last].accept_id = id;
+    nfa->pos[last].dir_only = dir_only;
 }
 
 
-// Performs a non-recursive depth-first traversal starting at 'start_path'
-// Counts the total number of lines in all `.c` and `.h` files encountered
-// Accumulates the result in the variable pointed to by 'total_lines'
-int walk_directory(const char *start_path, long *total_lines) {
-    // Ensure we have space in the traversal stack before starting
-    if (top >= STACK_SIZE) {
-        fprintf(stderr, "Initial stack overflow\n");
-        return -1;
+// Adds every position reachable through input-free jumps
+void glob_closure(const GlobNfa *nfa, uint64_t *set) {
+    // Jumps only go forward, so one ascending sweep reaches the fixpoint
+    for (int i = 0; i < nfa->npos; i++) {
+        int e = nfa->pos[i].eps;
+        if (e >= 0 && ((set[i >> 6] >> (i & 63)) & 1))
+            set[e >> 6] |= 1ULL << (e & 63);
     }
+}
+
+
+// Subset-construction bookkeeping: every DFA state's NFA position set,
+// stored back to back, plus a hash table to find a set's state again
+typedef struct {
+    uint64_t *sets;
+    int words;      // 64-bit words per set
+    int states;
+    int cap;
+    int32_t *hash;  // State ids, -1 for empty slots
+    size_t hcap;    // Power of two, kept at least twice 'states'
+} GlobBuilder;
 
-    // Push the initial path onto the global stack
-    snprintf(stack[top].path, MAX_PATH_SIZE, "%s", start_path);
-    top++;
+uint64_t glob_set_hash(const uint64_t *set, int words) {
+    uint64_t h = 1469598103934665603ULL;
+    for (int i = 0; i < words; i++) h = (h ^ set[i]) * 1099511628211ULL;
+    return h ^ (h >> 29);
+}
 
-    // Loop while there are directories left to process
-    while (top > 0) {
-        top--;
 
-        // Make a local copy of the current path (avoid pointer reuse issues)
-        char path[MAX_PATH_SIZE];
-        snprintf(path, sizeof(path), "%s", stack[top].path);
+// Returns the state id for a position set, adding a new state if needed
+// Returns -1 once GLOB_MAX_STATES is reached
+int32_t glob_intern(GlobBuilder *b, const uint64_t *set) {
+    size_t bytes = (size_t)b->words * sizeof(uint64_t);
+    size_t slot = glob_set_hash(set, b->words) & (b->hcap - 1);
+    for (; b->hash[slot] >= 0; slot = (slot + 1) & (b->hcap - 1))
+        if (memcmp(b->sets + (size_t)b->hash[slot] * b->words, set, bytes) == 0)
+            return b->hash[slot];
 
-        // Attempt to open the directory
-        DIR *dir = opendir(path);
-        if (!dir) {
-            perror(path);  // Print error and skip if directory can't be opened
-            continue;
+    if (b->states == GLOB_MAX_STATES) return -1;
+    if (b->states == b->cap) {
+        b->cap *= 2;
+        b->sets = realloc(b->sets, (size_t)b->cap * bytes);
+        if (!b->sets) {
+            perror("realloc");
+            exit(1);
         }
+    }
+    memcpy(b->sets + (size_t)b->states * b->words, set, bytes);
+    b->hash[slot] = b->states;
+    int32_t id = b->states++;
 
-        struct dirent *entry;
-        char fullpath[MAX_PATH_SIZE];  // Buffer to hold full path to each entry
+    if ((size_t)b->states * 2 > b->hcap) {
+        // Rehash into a table twice the size
+        free(b->hash);
+        b->hcap *= 2;
+        b->hash = malloc(b->hcap * sizeof(*b->hash));
+        if (!b->hash) {
+            perror("malloc");
+            exit(1);
+        }
+        for (size_t i = 0; i < b->hcap; i++) b->hash[i] = -1;
+        for (int s = 0; s < b->states; s++) {
+            size_t k = glob_set_hash(b->sets + (size_t)s * b->words, b->words) & (b->hcap - 1);
+            while (b->hash[k] >= 0) k = (k + 1) & (b->hcap - 1);
+            b->hash[k] = s;
+        }
+    }
+    return id;
+}
 
-        // Iterate over entries in the current directory
-        while ((entry = readdir(dir)) != NULL) {
-            // Skip "." and ".." entries to avoid infinite recursion
-            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
-                continue;
 
-            // Build full path to the file or subdirectory
-            snprintf(fullpath, sizeof(fullpath), "%s/%s", path, entry->d_name);
+// Turns the NFA into a DFA by subset construction
+// Returns 0 on success, -1 if the patterns need more than GLOB_MAX_STATES
+int glob_compile(const GlobNfa *nfa, GlobDfa *dfa) {
+    memset(dfa, 0, sizeof(*dfa));
 
-            // Retrieve file information (type, size, etc.)
-            struct stat st;
-            if (stat(fullpath, &st) == -1) {
-                perror(fullpath);  // Print error if stat fails
-                continue;
+    // Byte classes: bytes that behave identically at every position
+    unsigned char rep[256];
+    int classes = 0;
+    for (int c = 0; c < 256; c++) {
+        int found = -1;
+        for (int k = 0; k < classes && found < 0; k++) {
+            int same = 1;
+            for (int i = 0; i < nfa->npos && same; i++) {
+                const GlobPos *p = &nfa->pos[i];
+                same = BYTESET_HAS(p->loop, c) == BYTESET_HAS(p->loop, rep[k]) &&
+                       BYTESET_HAS(p->adv, c) == BYTESET_HAS(p->adv, rep[k]);
             }
+            if (same) found = k;
+        }
+        if (found < 0) {
+            found = classes;
+            rep[classes++] = (unsigned char)c;
+        }
+        dfa->byte_class[c] = (unsigned char)found;
+    }
+    dfa->classes = classes;
 
-            // If it's a directory, push it onto the stack to process later
-            if (S_ISDIR(st.st_mode)) {
-                if (should_ignore_dir(entry->d_name)) continue;
+    GlobBuilder b;
+    b.words = nfa->npos / 64 + 1;
+    b.states = 0;
+    b.cap = 64;
+    b.hcap = 256;
+    b.sets = malloc((size_t)b.cap * (size_t)b.words * sizeof(uint64_t));
+    b.hash = malloc(b.hcap * sizeof(*b.hash));
+    uint64_t *set = calloc((size_t)b.words, sizeof(uint64_t));
+    if (!b.sets || !b.hash || !set) {
+        perror("malloc");
+        exit(1);
+    }
+    for (size_t i = 0; i < b.hcap; i++) b.hash[i] = -1;
 
-                if (top >= STACK_SIZE) {
-                    fprintf(stderr, "Stack overflow\n");
-                    continue;
-                }
+    // State 0 is the empty set (GLOB_DEAD), state 1 the start (GLOB_START);
+    // with no patterns at all the two are the same set, so force a copy
+    glob_intern(&b, set);
+    for (int i = 0; i < nfa->nstarts; i++)
+        set[nfa->starts[i] >> 6] |= 1ULL << (nfa->starts[i] & 63);
+    glob_closure(nfa, set);
+    if (glob_intern(&b, set) != GLOB_START) {
+        memcpy(b.sets + (size_t)b.states * b.words, set, (size_t)b.words * sizeof(uint64_t));
+        b.states++;  // Unreachable through the hash table, which is fine
+    }
 
-                snprintf(stack[top].path, MAX_PATH_SIZE, "%s", fullpath);
-                top++;
+    int rows_cap = 0, ok = 1;
+    for (int s = 0; s < b.states && ok; s++) {
+        if (s >= rows_cap) {
+            rows_cap = rows_cap ? rows_cap * 2 : 64;
+            dfa->next = realloc(dfa->next, (size_t)rows_cap * classes * sizeof(*dfa->next));
+            dfa->accept = realloc(dfa->accept, (size_t)rows_cap * sizeof(*dfa->accept));
+            dfa->accept_file = realloc(dfa->accept_file, (size_t)rows_cap * sizeof(*dfa->accept_file));
+            if (!dfa->next || !dfa->accept || !dfa->accept_file) {
+                perror("realloc");
+                exit(1);
             }
+        }
 
-            // If it's a regular file and a .c or .h file, count its lines
-            else if (S_ISREG(st.st_mode)) {
-                if (should_count_file(entry->d_name)) {
-                    long file_lines = count_lines_in_file(fullpath);
-                    printf("%6ld lines  %s\n", file_lines, fullpath);
-                    *total_lines += file_lines;
-                }
+        const uint64_t *cur = b.sets + (size_t)s * b.words;
+        int best = -1, best_file = -1;
+        for (int i = 0; i < nfa->npos; i++) {
+            if (!((cur[i >> 6] >> (i & 63)) & 1)) continue;
+            int id = nfa->pos[i].accept_id;
+            if (id > best) best = id;
+            if (id > best_file && !nfa->pos[i].dir_only) best_file = id;
+        }
+        dfa->accept[s] = best;
+        dfa->accept_file[s] = best_file;
+
+        for (int k = 0; k < classes; k++) {
+            memset(set, 0, (size_t)b.words * sizeof(uint64_t));
+            for (int i = 0; i < nfa->npos; i++) {
+                if (!((cur[i >> 6] >> (i & 63)) & 1)) continue;
+                const GlobPos *p = &nfa->pos[i];
+                if (BYTESET_HAS(p->loop, rep[k])) set[i >> 6] |= 1ULL << (i & 63);
+                if (BYTESET_HAS(p->adv, rep[k])) set[(i + 1) >> 6] |= 1ULL << ((i + 1) & 63);
             }
+            glob_closure(nfa, set);
+            int32_t id = glob_intern(&b, set);
+            if (id < 0) {
+                ok = 0;
+                break;
+            }
+            dfa->next[s * classes + k] = id;
+            cur = b.sets + (size_t)s * b.words;  // glob_intern may have moved it
         }
+    }
 
-        closedir(dir);
+    dfa->states = b.states;
+    free(b.sets);
+    free(b.hash);
+    free(set);
+    return ok ? 0 : -1;
+}
+
+
+// Feeds one byte to the DFA
+static inline int32_t glob_step(const GlobDfa *dfa, int32_t state, unsigned char c) {
+    return dfa->next[state * dfa->classes + dfa->byte_class[c]];
+}
+
+
+// Feeds a whole string to the DFA
+int32_t glob_run(const GlobDfa *dfa, int32_t state, const char *s) {
+    for (; *s && state != GLOB_DEAD; s++)
+        state = glob_step(dfa, state, (unsigned char)*s);
+    return state;
+}
+
+
+void glob_nfa_free(GlobNfa *nfa) {
+    free(nfa->pos);
+    free(nfa->starts);
+    memset(nfa, 0, sizeof(*nfa));
+}
+
+
+void glob_dfa_free(GlobDfa *dfa) {
+    free(dfa->next);
+    free(dfa->accept);
+    free(dfa->accept_file);
+    memset(dfa, 0, sizeof(*dfa));
+}
+
+
+// Directories skipped unless --no-default-excludes is given
+#define DEFAULT_EXCLUDES ".git,.svn,build,bin,.vscode,obj"
+
+// All exclude patterns, compiled together once the arguments are parsed
+static GlobNfa exclude_nfa;
+static GlobDfa exclude_dfa;
+static int exclude_count = 0;
+
+// Adds a comma-separated list of --exclude-dir patterns
+void add_exclude_patterns(const char *list) {
+    char pattern[PATH_MAX];
+    while (*list) {
+        size_t len = strcspn(list, ",");
+        if (len > 0 && len < sizeof(pattern)) {
+            memcpy(pattern, list, len);
+            pattern[len] = '\0';
+            glob_add(&exclude_nfa, pattern, exclude_count++);
+        }
+        list += len;
+        if (*list == ',') list++;
     }
+}
 
+
+// Compiles every pattern added so far into exclude_dfa
+int compile_excludes(void) {
+    int rc = glob_compile(&exclude_nfa, &exclude_dfa);
+    glob_nfa_free(&exclude_nfa);
+    if (rc != 0) {
+        fprintf(stderr, "linebolt: too many or too complex --exclude-dir patterns\n");
+        return -1;
+    }
     return 0;
 }
 
 
-// Entry point of the program
-int main(void) {
-    // Record the start time using a monotonic (non-wall) clock
-    clock_gettime(CLOCK_MONOTONIC, &start);
-    long total_lines = 0;
+// Determines whether a directory should be skipped during traversal
+// 'state' is the matcher state of the directory containing 'name'.
+// Returns -1 if the directory is excluded, otherwise the state its own
+// entries continue from (GLOB_DEAD once no pattern can match below it).
+int32_t exclude_dir_state(int32_t state, const char *name) {
+    if (state == GLOB_DEAD) return GLOB_DEAD;
+    state = glob_run(&exclude_dfa, state, name);
+    if (exclude_dfa.accept[state] >= 0) return -1;
+    return glob_step(&exclude_dfa, state, '/');
+}
 
-    // Start recursive directory traversal from current directory (".")
-    // Accumulate total line count in total_lines
-    if (walk_directory(".", &total_lines) == 0) {
-        // If directory traversal succeeded, print final result
-        printf("\n=============================\n");
-        printf("Total lines: %ld\n", total_lines);
-    } else {
-        // If an error occurred, report it to stderr
-        fprintf(stderr, "Error walking the directory tree.\n");
+
+// ---------------------------------------------------------------------------
+// Ignore files (--gitignore)
+//
+// Every directory holding a .gitignore or .lineboltignore gets a rule set:
+// the patterns of both files compiled into one GlobDfa whose accepting
+// states name the last rule that matched. A set is chained to the set of
+// the nearest enclosing directory that had one, and every queued directory
+// carries one matcher state per set in its chain, so judging an entry
+// costs one pass over its name per set, innermost first. Sets are pushed
+// when their directory is scanned and freed by the last scan below them,
+// so only the rules along the current traversal frontier stay in memory.
+// ---------------------------------------------------------------------------
+
+// Ignore files larger than this are skipped with a warning
+#define IGNORE_FILE_MAX (16 * 1024 * 1024)
+
+typedef struct IgnoreRules {
+    struct IgnoreRules *parent;  // Set of an enclosing directory, or NULL
+    int depth;                   // Number of sets above this one
+    int refs;                    // Directories still using the set, plus child sets
+    unsigned char *negate;       // Per rule: 1 for a "!pattern" re-include
+    GlobDfa dfa;
+} IgnoreRules;
+
+static int use_ignore_files = 0;  // --gitignore
+
+// Files read in every directory, lowest priority first
+static const char *const ignore_file_names[] = {".gitignore", ".lineboltignore", NULL};
+
+// Read once, at the top of the repository, below every .gitignore
+static const char *const repo_exclude_names[] = {".git/info/exclude", NULL};
+
+
+// Adds the rules of one ignore file in the directory open at 'dir_fd' to
+// 'nfa', numbering them from '*count' on. A missing file adds nothing.
+void ignore_read_file(int dir_fd, const char *name, GlobNfa *nfa,
+                      unsigned char **negate, int *count, int *cap) {
+    int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return;
+    }
+    if (st.st_size > IGNORE_FILE_MAX) {
+        fprintf(stderr, "linebolt: %s too large, ignored\n", name);
+        close(fd);
+        return;
     }
+    char *text = malloc((size_t)st.st_size + 1);
+    if (!text) {
+        perror("malloc");
+        exit(1);
+    }
+    size_t len = 0;
+    ssize_t got;
+    while (len < (size_t)st.st_size &&
+           (got = read(fd, text + len, (size_t)st.st_size - len)) > 0)
+        len += (size_t)got;
+    close(fd);
+    text[len] = '\0';
 
-    // Record the end time after processing completes
-    clock_gettime(CLOCK_MONOTONIC, &end);
+    char pattern[PATH_MAX];
+    for (char *line = text; line < text + len;) {
+        char *eol = memchr(line, '\n', (size_t)(text + len - line));
+        if (!eol) eol = text + len;
+        char *start = line, *stop = eol;
+        line = eol + 1;
 
-    // Compute elapsed time in milliseconds
-    double elapsed_ms = (end.tv_sec - start.tv_sec) * 1000.0 + \
-                    (end.tv_nsec - start.tv_nsec) / 1e6;
+        // Trailing spaces are dropped unless escaped with a backslash
+        if (stop > start && stop[-1] == '\r') stop--;
+        while (stop > start && stop[-1] == ' ' && !(stop - start >= 2 && stop[-2] == '\\'))
+            stop--;
 
-    printf("\nExecution time: %.2f ms\n", elapsed_ms);
+        // Blank lines and comments; "\#" and "\!" reach glob_add() escaped
+        if (start == stop || *start == '#') continue;
+        int negated = *start == '!';
+        if (negated) start++;
+
+        size_t plen = (size_t)(stop - start);
+        if (plen == 0 || plen >= sizeof(pattern)) continue;
+        memcpy(pattern, start, plen);
+        pattern[plen] = '\0';
+        if (strcmp(pattern, "/") == 0) continue;
+
+        if (*count == *cap) {
+            *cap = *cap ? *cap * 2 : 64;
+            *negate = realloc(*negate, (size_t)*cap);
+            if (!*negate) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        (*negate)[*count] = (unsigned char)negated;
+        glob_add(nfa, pattern, (*count)++);
+    }
+    free(text);
+}
+
+
+// Loads the given ignore files of the directory open at 'dir_fd' and puts
+// their rule set on top of 'parent'. Returns 'parent' itself if there are
+// no rules; otherwise the new set, which takes over the caller's reference
+// to 'parent' and starts out with one reference of its own.
+IgnoreRules *ignore_rules_push(int dir_fd, IgnoreRules *parent, const char *const *names) {
+    GlobNfa nfa = {0};
+    unsigned char *negate = NULL;
+    int count = 0, cap = 0;
+    for (; *names; names++)
+        ignore_read_file(dir_fd, *names, &nfa, &negate, &count, &cap);
+    if (count == 0) {
+        glob_nfa_free(&nfa);
+        return parent;
+    }
+
+    IgnoreRules *rules = malloc(sizeof(*rules));
+    if (!rules) {
+        perror("malloc");
+        exit(1);
+    }
+    if (glob_compile(&nfa, &rules->dfa) != 0) {
+        fprintf(stderr, "linebolt: ignore rules too complex, skipped\n");
+        glob_nfa_free(&nfa);
+        glob_dfa_free(&rules->dfa);
+        free(negate);
+        free(rules);
+        return parent;
+    }
+    glob_nfa_free(&nfa);
+    rules->parent = parent;
+    rules->depth = parent ? parent->depth + 1 : 0;
+    rules->refs = 1;
+    rules->negate = negate;
+    return rules;
+}
+
+
+void ignore_rules_retain(IgnoreRules *rules) {
+    __atomic_add_fetch(&rules->refs, 1, __ATOMIC_RELAXED);
+}
+
+
+// Drops one reference; the last one frees the set and releases its parent
+void ignore_rules_release(IgnoreRules *rules) {
+    while (rules && __atomic_sub_fetch(&rules->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        IgnoreRules *parent = rules->parent;
+        glob_dfa_free(&rules->dfa);
+        free(rules->negate);
+        free(rules);
+        rules = parent;
+    }
+}
+
+
+// Decides whether 'name' is ignored, given the matcher states of its
+// directory ('states[r->depth]' for every set 'r' in the chain). As in git,
+// the deepest set with a matching rule decides, and within a set the last
+// matching rule. For a directory, 'child_states' receives the states its
+// own entries start from; files pass NULL.
+int ignore_entry(const IgnoreRules *rules, const int32_t *states, const char *name,
+                 int is_dir, int32_t *child_states) {
+    int ignored = 0, decided = 0;
+    for (const IgnoreRules *r = rules; r; r = r->parent) {
+        int32_t state = glob_run(&r->dfa, states[r->depth], name);
+        if (!decided) {
+            int32_t rule = is_dir ? r->dfa.accept[state] : r->dfa.accept_file[state];
+            if (rule >= 0) {
+                decided = 1;
+                ignored = !r->negate[rule];
+            }
+        }
+        if (!child_states) {
+            if (decided) break;
+            continue;
+        }
+        child_states[r->depth] = state == GLOB_DEAD ? GLOB_DEAD : glob_step(&r->dfa, state, '/');
+    }
+    return ignored;
+}
+
+
+// ignore_rules_push() for ignore_rules_above(), which keeps the states of
+// all sets in one growable array
+IgnoreRules *ignore_push_level(int dir_fd, IgnoreRules *rules, const char *const *names,
+                               int32_t **states, int *cap) {
+    IgnoreRules *pushed = ignore_rules_push(dir_fd, rules, names);
+    if (pushed == rules) return rules;
+    if (pushed->depth >= *cap) {
+        *cap = *cap ? *cap * 2 : 8;
+        *states = realloc(*states, (size_t)*cap * sizeof(**states));
+        if (!*states) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    (*states)[pushed->depth] = GLOB_START;
+    return pushed;
+}
+
+
+// Finds the git repository around 'start_path': returns its malloc()ed
+// real path, with '*top_len' set to the length of the repository top's
+// prefix of it (the nearest directory holding a .git entry), or NULL
+// if 'start_path' is not inside a repository
+char *find_repo_top(const char *start_path, size_t *top_len) {
+    char *real = realpath(start_path, NULL);
+    if (!real) return NULL;
+
+    char probe[PATH_MAX + 8];
+    size_t len = strlen(real);
+    for (;;) {
+        struct stat st;
+        snprintf(probe, sizeof(probe), "%.*s/.git", (int)len, real);
+        if (fstatat(AT_FDCWD, probe, &st, AT_SYMLINK_NOFOLLOW) == 0) break;
+        if (len == 0) {
+            free(real);
+            return NULL;
+        }
+        while (len > 0 && real[len - 1] != '/') len--;
+        if (len > 0) len--;  // Drop the '/' too
+    }
+    *top_len = len;
+    return real;
+}
+
+
+// Builds the rule sets that already apply at 'start_path' when it lies
+// inside a git repository: .git/info/exclude plus the ignore files of
+// every directory from the repository top down to, but not including,
+// 'start_path' (whose own files are read when it is scanned). The states
+// reached at 'start_path' are stored in a malloc()ed '*states'.
+IgnoreRules *ignore_rules_above(const char *start_path, int32_t **states) {
+    *states = NULL;
+    size_t top_len;
+    char *real = find_repo_top(start_path, &top_len);
+    if (!real) return NULL;
+
+    char probe[PATH_MAX + 8];
+    snprintf(probe, sizeof(probe), "%.*s/", (int)top_len, real);
+    int dir_fd = open(probe, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd == -1) {
+        free(real);
+        return NULL;
+    }
+
+    int cap = 0;
+    IgnoreRules *rules = ignore_push_level(dir_fd, NULL, repo_exclude_names, states, &cap);
+    const char *rest = real + top_len;
+    while (*rest == '/') rest++;
+
+    while (*rest && dir_fd != -1) {
+        rules = ignore_push_level(dir_fd, rules, ignore_file_names, states, &cap);
+
+        // Step every set's state into the next directory on the way down
+        size_t len = strcspn(rest, "/");
+        memcpy(probe, rest, len);
+        probe[len] = '\0';
+        for (IgnoreRules *r = rules; r; r = r->parent) {
+            int32_t state = glob_run(&r->dfa, (*states)[r->depth], probe);
+            (*states)[r->depth] = state == GLOB_DEAD ? GLOB_DEAD : glob_step(&r->dfa, state, '/');
+        }
+        int child_fd = openat(dir_fd, probe, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        close(dir_fd);
+        dir_fd = child_fd;
+        rest += len;
+        while (*rest == '/') rest++;
+    }
+    if (dir_fd != -1) close(dir_fd);
+    free(real);
+    return rules;
+}
+
+
+// ---------------------------------------------------------------------------
+// Newline counting kernels
+//
+// Each kernel returns the number of '\n' bytes in buf[0..len). The SIMD
+// variants compare a whole vector against '\n' at once; the SSE2 and AVX2
+// versions accumulate the compare results as per-byte counters and fold them
+// with a SAD every 255 iterations so the hot loop stays free of popcounts.
+// The best kernel for the running CPU is chosen once by init_newline_kernel().
+//
+// The --classify lexer uses two more families over 64-byte chunks, so it can
+// jump from one interesting byte to the next with a count-trailing-zeros:
+// chunk_masks_*() finds the newlines and the non-blank bytes, stop_mask_*()
+// the bytes of an arbitrary set (the ones that matter in the lexer's current
+// state). The latter is the "shufti" technique: a byte is in the set if the
+// table entries picked by its low and its high nibble share a bit, which
+// takes two byte shuffles per vector.
+// ---------------------------------------------------------------------------
+
+// Portable fallback: let the C library's (usually vectorized) memchr()
+// find each newline
+size_t count_newlines_scalar(const unsigned char *buf, size_t len) {
+    size_t count = 0;
+    const unsigned char *end = buf + len;
+    while (buf < end) {
+        const unsigned char *nl = memchr(buf, '\n', (size_t)(end - buf));
+        if (!nl) break;
+        count++;
+        buf = nl + 1;
+    }
+    return count;
+}
+
+// Newlines and non-blank bytes of a 64-byte chunk, one bit each
+typedef struct {
+    uint64_t newline;
+    uint64_t text;      // Anything but whitespace
+} ChunkMasks;
+
+// A set of bytes the lexer has to stop at in one of its states
+typedef struct {
+    unsigned char lo[16];  // Shufti tables: byte b is in the set iff
+    unsigned char hi[16];  // lo[b & 15] & hi[b >> 4] is not 0
+    uint64_t bits[4];      // The same set as a bitmap, for the portable kernel
+    unsigned char mark;    // Line mark of the state's plain text; 0 = no skipping
+} LangSkip;
+
+// 0x80 in every byte of 'x' that is zero, exactly (no borrow across bytes)
+static inline uint64_t swar_zero(uint64_t x) {
+    const uint64_t low7 = 0x7f7f7f7f7f7f7f7fULL;
+    return ~(((x & low7) + low7) | x | low7);
+}
+
+// swar_zero() of 'x' against byte 'c', gathered into 8 bits (byte 0 = bit 0)
+static inline uint64_t swar_eq(uint64_t x, unsigned char c) {
+    uint64_t hit = swar_zero(x ^ (0x0101010101010101ULL * c)) >> 7;
+    return (hit * 0x0102040810204080ULL) >> 56;
+}
+
+// Portable chunk classifier, eight bytes at a time in a 64-bit word
+void chunk_masks_scalar(const unsigned char *chunk, ChunkMasks *m) {
+    m->newline = m->text = 0;
+    for (int i = 0; i < 64; i += 8) {
+        uint64_t x;
+        memcpy(&x, chunk + i, sizeof(x));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        x = __builtin_bswap64(x);
+#endif
+        uint64_t newline = swar_eq(x, '\n');
+        uint64_t blank = newline | swar_eq(x, ' ') | swar_eq(x, '\t') |
+                         swar_eq(x, '\v') | swar_eq(x, '\f') | swar_eq(x, '\r');
+        m->newline |= newline << i;
+        m->text |= (~blank & 0xff) << i;
+    }
+}
+
+// Portable set search: one bitmap probe per byte
+uint64_t stop_mask_scalar(const unsigned char *chunk, const LangSkip *skip) {
+    uint64_t mask = 0;
+    for (int i = 0; i < 64; i++) {
+        unsigned char c = chunk[i];
+        mask |= (skip->bits[c >> 6] >> (c & 63) & 1) << i;
+    }
+    return mask;
+}
+
+#ifdef LINEBOLT_X86_SIMD
+
+// SSE2 kernel: part of the x86-64 baseline, so always available there
+__attribute__((target("sse2")))
+size_t count_newlines_sse2(const unsigned char *buf, size_t len) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i zero = _mm_setzero_si128();
+    size_t count = 0, i = 0;
+
+    while (len - i >= 16) {
+        // Byte counters overflow after 255 hits, so fold at least that often
+        size_t blocks = (len - i) / 16;
+        if (blocks > 255) blocks = 255;
+
+        __m128i acc = zero;
+        for (size_t b = 0; b < blocks; b++, i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, newline));
+        }
+
+        __m128i sums = _mm_sad_epu8(acc, zero);
+        count += (size_t)_mm_extract_epi16(sums, 0) + (size_t)_mm_extract_epi16(sums, 4);
+    }
+
+    return count + count_newlines_scalar(buf + i, len - i);
+}
+
+// AVX2 kernel: two 32-byte vectors per iteration to keep both load ports busy
+__attribute__((target("avx2")))
+size_t count_newlines_avx2(const unsigned char *buf, size_t len) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i zero = _mm256_setzero_si256();
+    size_t count = 0, i = 0;
+
+    while (len - i >= 64) {
+        size_t blocks = (len - i) / 64;
+        if (blocks > 255) blocks = 255;
+
+        __m256i acc0 = zero, acc1 = zero;
+        for (size_t b = 0; b < blocks; b++, i += 64) {
+            __m256i v0 = _mm256_loadu_si256((const __m256i *)(buf + i));
+            __m256i v1 = _mm256_loadu_si256((const __m256i *)(buf + i + 32));
+            acc0 = _mm256_sub_epi8(acc0, _mm256_cmpeq_epi8(v0, newline));
+            acc1 = _mm256_sub_epi8(acc1, _mm256_cmpeq_epi8(v1, newline));
+        }
+
+        __m256i sums = _mm256_add_epi64(_mm256_sad_epu8(acc0, zero),
+                                        _mm256_sad_epu8(acc1, zero));
+        count += (size_t)_mm256_extract_epi64(sums, 0) + (size_t)_mm256_extract_epi64(sums, 1) +
+                 (size_t)_mm256_extract_epi64(sums, 2) + (size_t)_mm256_extract_epi64(sums, 3);
+    }
+
+    return count + count_newlines_sse2(buf + i, len - i);
+}
+
+// AVX-512BW kernel: compares straight into a 64-bit mask and popcounts it
+__attribute__((target("avx512bw,popcnt")))
+size_t count_newlines_avx512bw(const unsigned char *buf, size_t len) {
+    const __m512i newline = _mm512_set1_epi8('\n');
+    size_t count = 0, i = 0;
+
+    for (; len - i >= 128; i += 128) {
+        __m512i v0 = _mm512_loadu_si512((const void *)(buf + i));
+        __m512i v1 = _mm512_loadu_si512((const void *)(buf + i + 64));
+        count += (size_t)__builtin_popcountll(_mm512_cmpeq_epi8_mask(v0, newline));
+        count += (size_t)__builtin_popcountll(_mm512_cmpeq_epi8_mask(v1, newline));
+    }
+
+    // Mask off the bytes past the end instead of falling back to scalar code
+    if (i < len) {
+        size_t rest = len - i;
+        if (rest > 64) {
+            __m512i v = _mm512_loadu_si512((const void *)(buf + i));
+            count += (size_t)__builtin_popcountll(_mm512_cmpeq_epi8_mask(v, newline));
+            i += 64;
+            rest -= 64;
+        }
+        __mmask64 tail = rest == 64 ? ~(__mmask64)0 : (((__mmask64)1 << rest) - 1);
+        __m512i v = _mm512_maskz_loadu_epi8(tail, (const void *)(buf + i));
+        count += (size_t)__builtin_popcountll(_mm512_mask_cmpeq_epi8_mask(tail, v, newline));
+    }
+
+    return count;
+}
+
+// 0xff in every byte of 'v' that is whitespace: ' ', or '\t'..'\r' (which
+// map to 0..4 after subtracting '\t')
+__attribute__((target("sse2")))
+static inline __m128i blank_bytes_sse2(__m128i v) {
+    __m128i ctrl = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+    return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                        _mm_cmpeq_epi8(_mm_min_epu8(ctrl, _mm_set1_epi8(4)), ctrl));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i blank_bytes_avx2(__m256i v) {
+    __m256i ctrl = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+    return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                           _mm256_cmpeq_epi8(_mm256_min_epu8(ctrl, _mm256_set1_epi8(4)), ctrl));
+}
+
+// SSE2 chunk classifier: four 16-byte vectors
+__attribute__((target("sse2")))
+void chunk_masks_sse2(const unsigned char *chunk, ChunkMasks *m) {
+    m->newline = m->text = 0;
+    for (int k = 0; k < 4; k++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(chunk + 16 * k));
+        __m128i newline = _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+        m->newline |= (uint64_t)(unsigned)_mm_movemask_epi8(newline) << (16 * k);
+        m->text |= (uint64_t)(unsigned)_mm_movemask_epi8(blank_bytes_sse2(v)) << (16 * k);
+    }
+    m->text = ~m->text;
+}
+
+// AVX2 chunk classifier: two 32-byte vectors
+__attribute__((target("avx2")))
+void chunk_masks_avx2(const unsigned char *chunk, ChunkMasks *m) {
+    __m256i lo = _mm256_loadu_si256((const __m256i *)chunk);
+    __m256i hi = _mm256_loadu_si256((const __m256i *)(chunk + 32));
+    const __m256i newline = _mm256_set1_epi8('\n');
+    m->newline = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, newline)) |
+                 (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, newline)) << 32;
+    m->text = ~((uint64_t)(uint32_t)_mm256_movemask_epi8(blank_bytes_avx2(lo)) |
+                (uint64_t)(uint32_t)_mm256_movemask_epi8(blank_bytes_avx2(hi)) << 32);
+}
+
+// AVX-512BW chunk classifier: every compare yields a 64-bit mask directly
+__attribute__((target("avx512bw")))
+void chunk_masks_avx512bw(const unsigned char *chunk, ChunkMasks *m) {
+    __m512i v = _mm512_loadu_si512((const void *)chunk);
+    __m512i ctrl = _mm512_sub_epi8(v, _mm512_set1_epi8('\t'));
+    m->newline = _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('\n'));
+    m->text = ~(_mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8(' ')) |
+                _mm512_cmple_epu8_mask(ctrl, _mm512_set1_epi8(4)));
+}
+
+// SSSE3 set search: pshufb is the first x86 byte shuffle
+__attribute__((target("ssse3")))
+uint64_t stop_mask_ssse3(const unsigned char *chunk, const LangSkip *skip) {
+    const __m128i lo_table = _mm_loadu_si128((const __m128i *)skip->lo);
+    const __m128i hi_table = _mm_loadu_si128((const __m128i *)skip->hi);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    uint64_t mask = 0;
+    for (int k = 0; k < 4; k++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(chunk + 16 * k));
+        __m128i lo = _mm_shuffle_epi8(lo_table, _mm_and_si128(v, nibble));
+        __m128i hi = _mm_shuffle_epi8(hi_table, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+        __m128i miss = _mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128());
+        mask |= (uint64_t)(unsigned)(~_mm_movemask_epi8(miss) & 0xffff) << (16 * k);
+    }
+    return mask;
+}
+
+// AVX2 set search: two 32-byte vectors
+__attribute__((target("avx2")))
+uint64_t stop_mask_avx2(const unsigned char *chunk, const LangSkip *skip) {
+    const __m256i lo_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)skip->lo));
+    const __m256i hi_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)skip->hi));
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    uint64_t mask = 0;
+    for (int k = 0; k < 2; k++) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(chunk + 32 * k));
+        __m256i lo = _mm256_shuffle_epi8(lo_table, _mm256_and_si256(v, nibble));
+        __m256i hi = _mm256_shuffle_epi8(hi_table, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+        __m256i miss = _mm256_cmpeq_epi8(_mm256_and_si256(lo, hi), _mm256_setzero_si256());
+        mask |= (uint64_t)(uint32_t)~_mm256_movemask_epi8(miss) << (32 * k);
+    }
+    return mask;
+}
+
+// AVX-512BW set search: one vector, and the test yields the mask
+__attribute__((target("avx512bw")))
+uint64_t stop_mask_avx512bw(const unsigned char *chunk, const LangSkip *skip) {
+    const __m512i lo_table = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)skip->lo));
+    const __m512i hi_table = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)skip->hi));
+    const __m512i nibble = _mm512_set1_epi8(0x0f);
+    __m512i v = _mm512_loadu_si512((const void *)chunk);
+    __m512i lo = _mm512_shuffle_epi8(lo_table, _mm512_and_si512(v, nibble));
+    __m512i hi = _mm512_shuffle_epi8(hi_table, _mm512_and_si512(_mm512_srli_epi16(v, 4), nibble));
+    return _mm512_test_epi8_mask(lo, hi);
+}
+
+#endif // LINEBOLT_X86_SIMD
+
+// Kernels selected at startup; scalar until init_newline_kernel() runs
+static size_t (*count_newlines)(const unsigned char *, size_t) = count_newlines_scalar;
+static void (*chunk_masks)(const unsigned char *, ChunkMasks *) = chunk_masks_scalar;
+static uint64_t (*stop_mask)(const unsigned char *, const LangSkip *) = stop_mask_scalar;
+static const char *newline_kernel_name = "scalar";
+
+// Picks the widest kernels the CPU supports (cpuid via the compiler)
+void init_newline_kernel(void) {
+#ifdef LINEBOLT_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("popcnt")) {
+        count_newlines = count_newlines_avx512bw;
+        newline_kernel_name = "avx512bw";
+    } else if (__builtin_cpu_supports("avx2")) {
+        count_newlines = count_newlines_avx2;
+        newline_kernel_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        count_newlines = count_newlines_sse2;
+        newline_kernel_name = "sse2";
+    }
+    if (__builtin_cpu_supports("avx512bw")) {
+        chunk_masks = chunk_masks_avx512bw;
+        stop_mask = stop_mask_avx512bw;
+    } else if (__builtin_cpu_supports("avx2")) {
+        chunk_masks = chunk_masks_avx2;
+        stop_mask = stop_mask_avx2;
+    } else {
+        if (__builtin_cpu_supports("sse2")) chunk_masks = chunk_masks_sse2;
+        if (__builtin_cpu_supports("ssse3")) stop_mask = stop_mask_ssse3;
+    }
+#endif
+}
+
+
+// ---------------------------------------------------------------------------
+// Line classification (--classify)
+//
+// With --classify every line is sorted into code, comment or blank in the
+// same pass that counts it, the way cloc does: a line holding any code is
+// code, one holding only comment text is a comment, and a line of nothing
+// but whitespace is blank (also inside a comment).
+//
+// Comment and string syntax comes from the language table below, keyed by
+// extension. At startup each language named by --ext is compiled into a
+// DFA over byte classes: a state is a lexer mode (code, line comment, block
+// comment at some nesting depth, string, escape) plus the prefix of a
+// comment or quote token read so far, and every transition carries the
+// mark its byte gives the line (code or comment). Counting then runs the
+// same table-driven loop for every language; nothing in it depends on
+// which language it is, and a language that is not used is never built.
+//
+// The loop does not visit every byte. In a steady state, one whose plain
+// text loops back to itself (code, or the inside of a comment or string),
+// only a few bytes can change anything: for C code that is '/', a quote or
+// a backslash. Each state keeps that set as shufti tables, and each 64-byte
+// chunk is searched for it with SIMD; the lines ending before the next such
+// byte are settled from the chunk's newline and non-blank masks with bit
+// operations alone.
+// ---------------------------------------------------------------------------
+
+#define LANG_MAX_TOKEN 8         // Longest comment or quote token
+#define LANG_MAX_TOKENS 24       // Tokens recognized in one lexer mode
+#define LANG_MAX_NEST 4          // Depth tracked for nesting block comments
+#define LANG_STATE_MASK 0x3fff   // Transitions: next state in the low 14 bits,
+#define LANG_MARK_SHIFT 14       // the line mark in the top 2
+
+// Line marks, also the bits of a line's flags
+#define MARK_CODE 1
+#define MARK_COMMENT 2
+
+// Language flags
+#define LANG_NESTED 1            // Block comments nest (Rust, Haskell, Swift...)
+#define LANG_CONTINUE 2          // Backslash-newline continues a line comment (C)
+
+// Comment and string syntax of one language. Token lists are separated by
+// spaces; 'block', 'strings' and 'docstrings' hold open/close pairs.
+// Docstrings are strings that count as comments when they start a line.
+typedef struct {
+    const char *name;
+    const char *extensions;      // Comma-separated, without dots
+    const char *line;            // Comments running to the end of the line
+    const char *block;
+    const char *strings;
+    const char *docstrings;
+    char escape;                 // Escape character inside strings, or 0
+    int flags;
+} LangDef;
+
+static const LangDef languages[] = {
+    {"C", "c,h", "//", "/* */", "\" \" ' '", NULL, '\\', LANG_CONTINUE},
+    {"C++", "cpp,cc,cxx,c++,hpp,hh,hxx,h++,ipp,tpp,inl", "//", "/* */", "\" \" ' '", NULL, '\\', LANG_CONTINUE},
+    {"Objective-C", "m,mm", "//", "/* */", "\" \" ' '", NULL, '\\', LANG_CONTINUE},
+    {"CUDA", "cu,cuh", "//", "/* */", "\" \" ' '", NULL, '\\', LANG_CONTINUE},
+    {"GLSL", "glsl,vert,frag,geom,comp,hlsl", "//", "/* */", "\" \"", NULL, '\\', LANG_CONTINUE},
+    {"Java", "java", "//", "/* */", "\" \" ' '", NULL, '\\', 0},
+    {"C#", "cs", "//", "/* */", "\" \" ' '", NULL, '\\', 0},
+    {"JavaScript", "js,mjs,cjs,jsx", "//", "/* */", "\" \" ' ' ` `", NULL, '\\', 0},
+    {"TypeScript", "ts,tsx,mts,cts", "//", "/* */", "\" \" ' ' ` `", NULL, '\\', 0},
+    {"Go", "go", "//", "/* */", "\" \" ' ' ` `", NULL, '\\', 0},
+    {"Rust", "rs", "//", "/* */", "\" \"", NULL, '\\', LANG_NESTED},
+    {"Swift", "swift", "//", "/* */", "\" \"", NULL, '\\', LANG_NESTED},
+    {"Kotlin", "kt,kts", "//", "/* */", "\" \" ' '", NULL, '\\', LANG_NESTED},
+    {"Scala", "scala,sc", "//", "/* */", "\" \" ' '", NULL, '\\', LANG_NESTED},
+    {"Dart", "dart", "//", "/* */", "\" \" ' '", NULL, '\\', LANG_NESTED},
+    {"Groovy", "groovy,gradle", "//", "/* */", "\" \" ' '", NULL, '\\', 0},
+    {"PHP", "php", "// #", "/* */", "\" \" ' '", NULL, '\\', 0},
+    {"Solidity", "sol", "//", "/* */", "\" \" ' '", NULL, '\\', 0},
+    {"Verilog", "v,sv,svh,vh", "//", "/* */", "\" \"", NULL, '\\', 0},
+    {"Protocol Buffers", "proto", "//", "/* */", "\" \" ' '", NULL, '\\', 0},
+    {"Zig", "zig", "//", NULL, "\" \" ' '", NULL, '\\', 0},
+    {"D", "d", "//", "/* */ /+ +/", "\" \" ` `", NULL, '\\', 0},
+    {"CSS", "css", NULL, "/* */", "\" \" ' '", NULL, '\\', 0},
+    {"SCSS", "scss,sass,less", "//", "/* */", "\" \" ' '", NULL, '\\', 0},
+    {"Python", "py,pyi,pyw", "#", NULL, "\"\"\" \"\"\" ''' ''' \" \" ' '", "\"\"\" \"\"\" ''' '''", '\\', 0},
+    {"Ruby", "rb,rake,gemspec", "#", NULL, "\" \" ' '", NULL, '\\', 0},
+    {"Perl", "pl,pm", "#", NULL, "\" \" ' '", NULL, '\\', 0},
+    {"Shell", "sh,bash,zsh,ksh", "#", NULL, "\" \" ' '", NULL, '\\', 0},
+    {"PowerShell", "ps1,psm1,psd1", "#", "<# #>", "\" \" ' '", NULL, '`', 0},
+    {"R", "r", "#", NULL, "\" \" ' '", NULL, '\\', 0},
+    {"Julia", "jl", "#", "#= =#", "\" \"", NULL, '\\', LANG_NESTED},
+    {"Nim", "nim", "#", "#[ ]#", "\" \"", NULL, '\\', LANG_NESTED},
+    {"Elixir", "ex,exs", "#", NULL, "\" \" ' '", NULL, '\\', 0},
+    {"CoffeeScript", "coffee", "#", "### ###", "\" \" ' '", NULL, '\\', 0},
+    {"CMake", "cmake", "#", "#[[ ]]", "\" \"", NULL, '\\', 0},
+    {"Makefile", "mk,mak", "#", NULL, NULL, NULL, 0, 0},
+    {"Tcl", "tcl", "#", NULL, "\" \"", NULL, '\\', 0},
+    {"YAML", "yaml,yml", "#", NULL, "\" \" ' '", NULL, '\\', 0},
+    {"TOML", "toml", "#", NULL, "\" \" ' '", NULL, '\\', 0},
+    {"GraphQL", "graphql,gql", "#", NULL, "\" \"", NULL, '\\', 0},
+    {"Terraform", "tf,hcl", "# //", "/* */", "\" \"", NULL, '\\', 0},
+    {"SQL", "sql", "--", "/* */", "' ' \" \"", NULL, 0, 0},
+    // Long brackets close only at the same level: levels 0 to 3 are listed
+    {"Lua", "lua", "--", "--[[ ]] --[=[ ]=] --[==[ ]==] --[===[ ]===]",
+     "\" \" ' ' [[ ]] [=[ ]=] [==[ ]==] [===[ ]===]", NULL, '\\', 0},
+    {"Haskell", "hs", "--", "{- -}", "\" \"", NULL, '\\', LANG_NESTED},
+    {"Elm", "elm", "--", "{- -}", "\" \"", NULL, '\\', LANG_NESTED},
+    {"Ada", "adb,ads", "--", NULL, "\" \"", NULL, 0, 0},
+    {"VHDL", "vhd,vhdl", "--", NULL, "\" \"", NULL, 0, 0},
+    {"Lisp", "lisp,lsp,cl,el,scm,ss,rkt", ";", "#| |#", "\" \"", NULL, '\\', LANG_NESTED},
+    {"Clojure", "clj,cljs,cljc,edn", ";", NULL, "\" \"", NULL, '\\', 0},
+    {"Assembly", "s,asm", "; #", "/* */", "\" \"", NULL, '\\', 0},
+    {"INI", "ini,cfg", "; #", NULL, NULL, NULL, 0, 0},
+    {"Erlang", "erl,hrl", "%", NULL, "\" \"", NULL, '\\', 0},
+    {"TeX", "tex,sty,cls", "%", NULL, NULL, NULL, 0, 0},
+    {"Fortran", "f90,f95,f03,f08", "!", NULL, "\" \" ' '", NULL, 0, 0},
+    {"Visual Basic", "vb,vbs,bas", "'", NULL, "\" \"", NULL, 0, 0},
+    {"OCaml", "ml,mli", NULL, "(* *)", "\" \"", NULL, '\\', LANG_NESTED},
+    {"F#", "fs,fsi,fsx", "//", "(* *)", "\" \"", NULL, '\\', 0},
+    {"Pascal", "pas,pp,dpr", "//", "{ } (* *)", "' '", NULL, 0, 0},
+    {"HTML", "html,htm,xhtml,vue,svelte", NULL, "<!-- -->", NULL, NULL, 0, 0},
+    {"XML", "xml,xsd,xsl,xslt,svg,plist,csproj,vcxproj", NULL, "<!-- -->", NULL, NULL, 0, 0},
+    {"Markdown", "md,markdown", NULL, "<!-- -->", NULL, NULL, 0, 0},
+};
+
+// Extensions without a definition: every non-blank line is code
+static const LangDef plain_text = {"Text", "", NULL, NULL, NULL, NULL, 0, 0};
+
+// A compiled language
+typedef struct {
+    const char *name;
+    uint16_t *next;              // states x classes
+    LangSkip *skip;              // Per state
+    unsigned char byte_class[256];
+    int classes;
+    int states;                  // State 0 is the start of a file
+} LangDfa;
+
+// Lines of one file (or of a whole run) by kind
+typedef struct {
+    long code;
+    long comment;
+    long blank;
+} LineKinds;
+
+static int classify_lines = 0;   // --classify
+static int *ext_language;        // Per --ext extension: index into languages[], or -1
+static const LangDfa **ext_lang; // Per --ext extension, with --classify
+
+
+// ---------------------------------------------------------------------------
+// Content hashing (--dedup)
+//
+// To spot byte-identical files, every block a scan reads is also fed to a
+// 64-bit hash while it is still in cache, so no file is read twice. The
+// hash is XXH64: four independent multiply-rotate lanes over 32-byte
+// stripes, which runs at memory speed, then a fold of the lanes and the
+// leftover bytes. Blocks arrive in arbitrary sizes, so an incomplete stripe
+// waits in 'tail' for the next one.
+// ---------------------------------------------------------------------------
+
+#define HASH_P1 0x9e3779b185ebca87ULL
+#define HASH_P2 0xc2b2ae3d27d4eb4fULL
+#define HASH_P3 0x165667b19e3779f9ULL
+#define HASH_P4 0x85ebca77c2b2ae63ULL
+#define HASH_P5 0x27d4eb2f165667c5ULL
+
+typedef struct {
+    uint64_t lanes[4];
+    uint64_t total;             // Bytes fed so far
+    unsigned char tail[32];     // Start of an incomplete stripe
+    size_t tail_len;
+} ContentHash;
+
+static int dedup_files = 0;     // --dedup
+
+static inline uint64_t hash_rotl(uint64_t x, int r) {
+    return x << r | x >> (64 - r);
+}
+
+static inline uint64_t hash_read64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t input) {
+    return hash_rotl(acc + input * HASH_P2, 31) * HASH_P1;
+}
+
+
+// Sets up a hash of no bytes (seed 0)
+void content_hash_start(ContentHash *h) {
+    h->lanes[0] = HASH_P1 + HASH_P2;
+    h->lanes[1] = HASH_P2;
+    h->lanes[2] = 0;
+    h->lanes[3] = -HASH_P1;
+    h->total = 0;
+    h->tail_len = 0;
+}
+
+
+// Mixes whole stripes into the lanes
+static void content_hash_stripes(ContentHash *h, const unsigned char *p, size_t stripes) {
+    uint64_t v0 = h->lanes[0], v1 = h->lanes[1], v2 = h->lanes[2], v3 = h->lanes[3];
+    for (; stripes > 0; stripes--, p += 32) {
+        v0 = hash_round(v0, hash_read64(p));
+        v1 = hash_round(v1, hash_read64(p + 8));
+        v2 = hash_round(v2, hash_read64(p + 16));
+        v3 = hash_round(v3, hash_read64(p + 24));
+    }
+    h->lanes[0] = v0, h->lanes[1] = v1, h->lanes[2] = v2, h->lanes[3] = v3;
+}
+
+
+// Feeds the next bytes of the contents
+void content_hash_update(ContentHash *h, const unsigned char *p, size_t len) {
+    h->total += len;
+    if (h->tail_len) {
+        size_t take = 32 - h->tail_len < len ? 32 - h->tail_len : len;
+        memcpy(h->tail + h->tail_len, p, take);
+        h->tail_len += take;
+        p += take;
+        len -= take;
+        if (h->tail_len < 32) return;
+        content_hash_stripes(h, h->tail, 1);
+        h->tail_len = 0;
+    }
+    content_hash_stripes(h, p, len / 32);
+    p += len / 32 * 32;
+    h->tail_len = len % 32;
+    memcpy(h->tail, p, h->tail_len);
+}
+
+
+// Returns the hash of everything fed; never 0, which stands for "no hash"
+uint64_t content_hash_finish(const ContentHash *h) {
+    uint64_t acc;
+    if (h->total >= 32) {
+        acc = hash_rotl(h->lanes[0], 1) + hash_rotl(h->lanes[1], 7) +
+              hash_rotl(h->lanes[2], 12) + hash_rotl(h->lanes[3], 18);
+        for (int i = 0; i < 4; i++)
+            acc = (acc ^ hash_round(0, h->lanes[i])) * HASH_P1 + HASH_P4;
+    } else {
+        acc = h->lanes[2] + HASH_P5;
+    }
+    acc += h->total;
+
+    const unsigned char *p = h->tail, *end = h->tail + h->tail_len;
+    for (; end - p >= 8; p += 8)
+        acc = hash_rotl(acc ^ hash_round(0, hash_read64(p)), 27) * HASH_P1 + HASH_P4;
+    if (end - p >= 4) {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        acc = hash_rotl(acc ^ v * HASH_P1, 23) * HASH_P2 + HASH_P3;
+        p += 4;
+    }
+    for (; p < end; p++)
+        acc = hash_rotl(acc ^ *p * HASH_P5, 11) * HASH_P1;
+
+    acc ^= acc >> 33;
+    acc *= HASH_P2;
+    acc ^= acc >> 29;
+    acc *= HASH_P3;
+    acc ^= acc >> 32;
+    return acc ? acc : 1;
+}
+
+
+// Running state of a line count over one file's contents, fed block by block
+typedef struct {
+    long lines;
+    long bytes;
+    int has_content;            // Whether file has at least 1 non-empty char
+    int last_char_was_newline;  // Track if last char is a newline
+    const LangDfa *lang;        // --classify only: the file's language...
+    unsigned state;             // ...its lexer state
+    unsigned line_flags;        // MARK_* seen on the current line
+    LineKinds kinds;            // Finished lines by kind
+    int hashing;                // --dedup only: the contents' hash so far
+    ContentHash hash;
+} LineScan;
+
+
+// One lexer mode while a language is compiled
+typedef struct {
+    char text[LANG_MAX_TOKEN + 1];
+    int len;
+    int mark;                    // Line mark of the token's own bytes
+    int target;                  // Mode after it
+} LangToken;
+
+typedef struct {
+    int mark;                    // Line mark of plain text
+    int after_text;              // Mode after a plain non-blank byte
+    int newline;                 // Mode after a newline
+    int escape;                  // Takes the next byte and returns to 'parent'...
+    int reparse;                 // ...which then looks at that byte again
+    int parent;
+    int token_count;
+    LangToken tokens[LANG_MAX_TOKENS];
+} LangMode;
+
+// Lexer state while a language is compiled: a mode plus the bytes of a
+// token read so far
+typedef struct {
+    int mode;
+    int len;
+    char pending[LANG_MAX_TOKEN];
+} LangKey;
+
+
+static inline int lang_blank(unsigned char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+
+// Splits a space-separated token list; returns the number of tokens
+int lang_split(const char *list, char tokens[][LANG_MAX_TOKEN + 1], int max) {
+    int count = 0;
+    while (list && *list && count < max) {
+        size_t len = strcspn(list, " ");
+        if (len > 0 && len <= LANG_MAX_TOKEN) {
+            memcpy(tokens[count], list, len);
+            tokens[count++][len] = '\0';
+        }
+        list += len;
+        while (*list == ' ') list++;
+    }
+    return count;
+}
+
+
+void lang_add_token(LangMode *mode, const char *text, int mark, int target) {
+    if (mode->token_count == LANG_MAX_TOKENS) return;
+    LangToken *t = &mode->tokens[mode->token_count++];
+    size_t len = strlen(text);
+    if (len > LANG_MAX_TOKEN) len = LANG_MAX_TOKEN;
+    memcpy(t->text, text, len);
+    t->text[len] = '\0';
+    t->len = (int)len;
+    t->mark = mark;
+    t->target = target;
+}
+
+
+// Finds the first token of 'mode' spelled exactly 'text' (*exact, or -1)
+// and whether some token is a longer extension of it (*longer)
+void lang_match(const LangMode *mode, const char *text, int len, int *exact, int *longer) {
+    *exact = -1;
+    *longer = 0;
+    for (int i = 0; i < mode->token_count; i++) {
+        const LangToken *t = &mode->tokens[i];
+        if (t->len < len || memcmp(t->text, text, (size_t)len) != 0) continue;
+        if (t->len > len) *longer = 1;
+        else if (*exact < 0) *exact = i;
+    }
+}
+
+
+// Feeds one byte to a lexer state and returns the marks it gives the line.
+// Tokens are matched longest first: bytes that could still grow into a
+// longer token stay pending, and once they cannot, the longest token at
+// their start is taken (or the first byte is plain text) and the rest is
+// fed again.
+int lang_feed(const LangMode *modes, LangKey *key, unsigned char c) {
+    unsigned char queue[LANG_MAX_TOKEN + 1];
+    int head = 0, tail = key->len;
+    memcpy(queue, key->pending, (size_t)key->len);
+    queue[tail++] = c;
+    key->len = 0;
+
+    int mark = 0;
+    while (head < tail) {
+        unsigned char b = queue[head++];
+        const LangMode *mode = &modes[key->mode];
+        if (mode->escape) {
+            if (b == '\r') continue;  // "\\\r\n" still escapes the newline
+            if (b == '\n') {
+                key->mode = mode->newline;
+                continue;
+            }
+            key->mode = mode->parent;
+            if (mode->reparse) head--;
+            else if (!lang_blank(b)) mark |= mode->mark;
+            continue;
+        }
+        if (key->len == 0 && b == '\n') {
+            key->mode = mode->newline;
+            continue;
+        }
+
+        int exact, longer;
+        key->pending[key->len] = (char)b;
+        lang_match(mode, key->pending, key->len + 1, &exact, &longer);
+        if (longer) {
+            key->len++;
+            continue;
+        }
+        if (exact >= 0) {
+            mark |= mode->tokens[exact].mark;
+            key->mode = mode->tokens[exact].target;
+            key->len = 0;
+            continue;
+        }
+        if (key->len == 0) {
+            if (!lang_blank(b)) {
+                mark |= mode->mark;
+                key->mode = mode->after_text;
+            }
+            continue;
+        }
+
+        // The pending bytes plus 'b' are no token: settle their start
+        int held = key->len, used = 1;
+        key->len = 0;
+        for (int len = held; len > 0; len--) {
+            lang_match(mode, key->pending, len, &exact, &longer);
+            if (exact >= 0) {
+                used = len;
+                break;
+            }
+        }
+        if (exact >= 0) {
+            mark |= mode->tokens[exact].mark;
+            key->mode = mode->tokens[exact].target;
+        } else {
+            mark |= mode->mark;  // Token bytes are never blank
+            key->mode = mode->after_text;
+        }
+        head = head - 1 - held + used;  // They were read right before 'b'
+    }
+    return mark;
+}
+
+
+// Sets up the modes of a language; returns the number of modes
+int lang_modes(const LangDef *def, LangMode *modes, int max) {
+    char line[8][LANG_MAX_TOKEN + 1], block[16][LANG_MAX_TOKEN + 1];
+    char strings[16][LANG_MAX_TOKEN + 1], docs[8][LANG_MAX_TOKEN + 1];
+    int lines = lang_split(def->line, line, 8);
+    int blocks = lang_split(def->block, block, 16) / 2;
+    int string_count = lang_split(def->strings, strings, 16) / 2;
+    int doc_count = lang_split(def->docstrings, docs, 8) / 2;
+    int depth = def->flags & LANG_NESTED ? LANG_MAX_NEST : 1;
+    int escape = def->escape != 0;
+    char escape_text[2] = {def->escape, '\0'};
+
+    // Mode numbers: code, then (with docstrings) code at the start of a line
+    int code = 0, fresh = doc_count ? 1 : 0;
+    int count = fresh + 1;
+    int line_mode = lines ? count++ : -1;
+    int line_escape = lines && escape && (def->flags & LANG_CONTINUE) ? count++ : -1;
+    int block_mode = count;
+    count += blocks * depth;
+    int string_mode = count;
+    count += string_count * (1 + escape);
+    int doc_mode = count;
+    count += doc_count * (1 + escape);
+    if (count > max) return -1;
+    memset(modes, 0, (size_t)count * sizeof(*modes));
+
+    for (int m = 0; m <= fresh; m++) {
+        LangMode *mode = &modes[m];
+        mode->mark = MARK_CODE;
+        mode->after_text = code;
+        mode->newline = fresh;
+        if (m == fresh && m != code)
+            for (int i = 0; i < doc_count; i++)
+                lang_add_token(mode, docs[2 * i], MARK_COMMENT, doc_mode + i * (1 + escape));
+        for (int i = 0; i < lines; i++) lang_add_token(mode, line[i], MARK_COMMENT, line_mode);
+        for (int i = 0; i < blocks; i++)
+            lang_add_token(mode, block[2 * i], MARK_COMMENT, block_mode + i * depth);
+        for (int i = 0; i < string_count; i++)
+            lang_add_token(mode, strings[2 * i], MARK_CODE, string_mode + i * (1 + escape));
+    }
+    if (line_mode >= 0) {
+        modes[line_mode] = (LangMode){.mark = MARK_COMMENT, .after_text = line_mode, .newline = fresh};
+        if (line_escape >= 0) {
+            lang_add_token(&modes[line_mode], escape_text, MARK_COMMENT, line_escape);
+            modes[line_escape] = (LangMode){.mark = MARK_COMMENT, .newline = line_mode, .escape = 1,
+                                            .reparse = 1, .parent = line_mode};
+        }
+    }
+    for (int i = 0; i < blocks; i++) {
+        for (int d = 0; d < depth; d++) {
+            int m = block_mode + i * depth + d;
+            modes[m] = (LangMode){.mark = MARK_COMMENT, .after_text = m, .newline = m};
+            lang_add_token(&modes[m], block[2 * i + 1], MARK_COMMENT, d ? m - 1 : code);
+            if (d + 1 < depth) lang_add_token(&modes[m], block[2 * i], MARK_COMMENT, m + 1);
+        }
+    }
+    for (int i = 0; i < string_count + doc_count; i++) {
+        int is_doc = i >= string_count;
+        const char *open = is_doc ? docs[2 * (i - string_count)] : strings[2 * i];
+        const char *close = is_doc ? docs[2 * (i - string_count) + 1] : strings[2 * i + 1];
+        int m = is_doc ? doc_mode + (i - string_count) * (1 + escape) : string_mode + i * (1 + escape);
+        int mark = is_doc ? MARK_COMMENT : MARK_CODE;
+
+        // A one-character quote that closes itself ends at the newline (an
+        // unterminated literal); longer ones and backquotes span lines
+        int single = !is_doc && strlen(open) == 1 && strcmp(open, close) == 0 && open[0] != '`';
+        modes[m] = (LangMode){.mark = mark, .after_text = m, .newline = single ? fresh : m};
+        lang_add_token(&modes[m], close, mark, code);
+        if (escape) {
+            lang_add_token(&modes[m], escape_text, mark, m + 1);
+            modes[m + 1] = (LangMode){.mark = mark, .newline = m, .escape = 1, .parent = m};
+        }
+    }
+    return count;
+}
+
+
+// Returns the number of the state 'key', adding it if it is new
+int lang_intern(LangKey **keys, int *count, int *cap, const LangKey *key) {
+    for (int i = 0; i < *count; i++)
+        if ((*keys)[i].mode == key->mode && (*keys)[i].len == key->len &&
+            memcmp((*keys)[i].pending, key->pending, (size_t)key->len) == 0)
+            return i;
+    if (*count == *cap) {
+        *cap = *cap ? 2 * *cap : 64;
+        *keys = realloc(*keys, (size_t)*cap * sizeof(**keys));
+        if (!*keys) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    (*keys)[*count] = *key;
+    return (*count)++;
+}
+
+
+// Works out which bytes a state has to stop at. A state can be skipped
+// through if plain text loops back to it with one mark and blanks loop
+// back with none; it stops at every byte that does anything else, the
+// newline included unless that also loops back unmarked.
+void lang_skip_setup(LangDfa *lang, int state, const unsigned char *class_rep) {
+    LangSkip *skip = &lang->skip[state];
+    memset(skip, 0, sizeof(*skip));
+    const uint16_t *row = lang->next + (size_t)state * (size_t)lang->classes;
+    int text = row[lang->byte_class[class_rep[0]]], blank = row[lang->byte_class[' ']];
+    if ((text & LANG_STATE_MASK) != state || blank != state) return;
+    int mark = text >> LANG_MARK_SHIFT;
+
+    uint16_t lows[16] = {0};  // Per high nibble, the low nibbles that stop
+    for (int c = 0; c < 256; c++) {
+        int t = row[lang->byte_class[c]];
+        int boring = (t & LANG_STATE_MASK) == state &&
+                     (t >> LANG_MARK_SHIFT == 0 || (t >> LANG_MARK_SHIFT == mark && c != '\n'));
+        if (boring) continue;
+        skip->bits[c >> 6] |= (uint64_t)1 << (c & 63);
+        lows[c >> 4] |= (uint16_t)(1u << (c & 15));
+    }
+
+    // One shufti bucket per distinct set of low nibbles
+    uint16_t buckets[8];
+    int bucket_count = 0;
+    for (int hi = 0; hi < 16; hi++) {
+        if (!lows[hi]) continue;
+        int b = 0;
+        while (b < bucket_count && buckets[b] != lows[hi]) b++;
+        if (b == bucket_count) {
+            if (bucket_count == 8) return;  // Too irregular: no skipping
+            buckets[bucket_count++] = lows[hi];
+        }
+        skip->hi[hi] |= (unsigned char)(1u << b);
+        for (int lo = 0; lo < 16; lo++)
+            if (lows[hi] >> lo & 1) skip->lo[lo] |= (unsigned char)(1u << b);
+    }
+    skip->mark = (unsigned char)mark;
+}
+
+
+// Compiles a language definition into its DFA
+LangDfa *lang_compile(const LangDef *def) {
+    LangMode modes[64];
+    if (lang_modes(def, modes, 64) < 0) {
+        fprintf(stderr, "linebolt: language %s has too many modes\n", def->name);
+        exit(1);
+    }
+    LangDfa *lang = calloc(1, sizeof(*lang));
+    if (!lang) {
+        perror("calloc");
+        exit(1);
+    }
+    lang->name = def->name;
+
+    // Bytes in tokens get classes of their own; the rest is blank or text
+    unsigned char special[256] = {0};
+    special['\n'] = special['\r'] = 1;
+    special[(unsigned char)def->escape] = def->escape != 0;
+    const char *lists[] = {def->line, def->block, def->strings, def->docstrings};
+    for (int i = 0; i < 4; i++)
+        for (const char *p = lists[i]; p && *p; p++)
+            if (*p != ' ') special[(unsigned char)*p] = 1;
+    unsigned char class_rep[256];
+    lang->classes = 2;
+    class_rep[1] = ' ';
+    class_rep[0] = 0;
+    for (int c = 0; c < 256; c++) {
+        if (special[c]) {
+            class_rep[lang->classes] = (unsigned char)c;
+            lang->byte_class[c] = (unsigned char)lang->classes++;
+        } else {
+            lang->byte_class[c] = lang_blank((unsigned char)c) ? 1 : 0;
+            if (!lang_blank((unsigned char)c) && class_rep[0] == 0) class_rep[0] = (unsigned char)c;
+        }
+    }
+    if (class_rep[0] == 0) class_rep[0] = 0x80;
+
+    // Breadth-first over the reachable states
+    LangKey *keys = NULL;
+    int count = 0, cap = 0;
+    LangKey start = {.mode = def->docstrings ? 1 : 0};
+    lang_intern(&keys, &count, &cap, &start);
+    size_t row_cap = 0;
+    for (int s = 0; s < count; s++) {
+        if ((size_t)count > row_cap) {
+            row_cap = 2 * (size_t)count;
+            lang->next = realloc(lang->next, row_cap * (size_t)lang->classes * sizeof(*lang->next));
+            if (!lang->next) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        for (int k = 0; k < lang->classes; k++) {
+            LangKey key = keys[s];
+            int mark = lang_feed(modes, &key, class_rep[k]);
+            int t = lang_intern(&keys, &count, &cap, &key);
+            if (t > LANG_STATE_MASK) {
+                fprintf(stderr, "linebolt: language %s has too many states\n", def->name);
+                exit(1);
+            }
+            lang->next[(size_t)s * (size_t)lang->classes + (size_t)k] = (uint16_t)(t | mark << LANG_MARK_SHIFT);
+        }
+    }
+    free(keys);
+    lang->states = count;
+
+    lang->skip = malloc((size_t)count * sizeof(*lang->skip));
+    if (!lang->skip) {
+        perror("malloc");
+        exit(1);
+    }
+    for (int s = 0; s < count; s++) lang_skip_setup(lang, s, class_rep);
+    return lang;
+}
+
+
+// Finds the language of every --ext extension. An extension matches a
+// language's list exactly, or by its last dotted part ("d.ts" is
+// TypeScript); anything else (-1) is plain text.
+void assign_languages(void) {
+    int n = (int)(sizeof(languages) / sizeof(*languages));
+    ext_language = malloc((size_t)ext_matcher.count * sizeof(*ext_language));
+    if (!ext_language) {
+        perror("malloc");
+        exit(1);
+    }
+
+    for (int e = 0; e < ext_matcher.count; e++) {
+        const char *dot = strrchr(ext_matcher.names[e], '.');
+        const char *names[2] = {ext_matcher.names[e], dot ? dot + 1 : NULL};
+        int found = -1;
+        for (int pass = 0; pass < 2 && found < 0 && names[pass]; pass++) {
+            size_t len = strlen(names[pass]);
+            for (int i = 0; i < n && found < 0; i++) {
+                for (const char *p = languages[i].extensions; *p;) {
+                    size_t item = strcspn(p, ",");
+                    if (item == len && strncmp(p, names[pass], len) == 0) {
+                        found = i;
+                        break;
+                    }
+                    p += item + (p[item] == ',');
+                }
+            }
+        }
+        ext_language[e] = found;
+    }
+}
+
+
+// Returns the name of the language of --ext extension 'ext'
+const char *language_name(int ext) {
+    return ext_language[ext] >= 0 ? languages[ext_language[ext]].name : plain_text.name;
+}
+
+
+// Compiles the language of every --ext extension, each one used once
+void compile_languages(void) {
+    const LangDfa *compiled[sizeof(languages) / sizeof(*languages) + 1] = {0};
+    size_t text = sizeof(languages) / sizeof(*languages);
+    ext_lang = calloc((size_t)ext_matcher.count, sizeof(*ext_lang));
+    if (!ext_lang) {
+        perror("calloc");
+        exit(1);
+    }
+
+    for (int e = 0; e < ext_matcher.count; e++) {
+        size_t i = ext_language[e] >= 0 ? (size_t)ext_language[e] : text;
+        if (!compiled[i]) compiled[i] = lang_compile(i < text ? &languages[i] : &plain_text);
+        ext_lang[e] = compiled[i];
+    }
+}
+
+
+// Starts a scan of a file matching --ext extension 'ext': classified by
+// its language with --classify, a plain line count otherwise
+void scan_start(LineScan *scan, int ext) {
+    memset(scan, 0, sizeof(*scan));
+    if (classify_lines && ext >= 0) scan->lang = ext_lang[ext];
+    if (dedup_files) {
+        scan->hashing = 1;
+        content_hash_start(&scan->hash);
+    }
+}
+
+
+// Lexes one block of file contents, counting and classifying its lines
+void classify_block(LineScan *scan, const unsigned char *buf, size_t len) {
+    static const unsigned char kind_of[4] = {2, 0, 1, 0};  // Line flags -> code, comment, blank
+    const LangDfa *lang = scan->lang;
+    unsigned state = scan->state, flags = scan->line_flags;
+    long counts[3] = {0, 0, 0};
+    unsigned char tail[64];
+
+    for (size_t base = 0; base < len; base += 64) {
+        size_t n = len - base < 64 ? len - base : 64;
+        const unsigned char *chunk = buf + base;
+        if (n < 64) {
+            // Pad the last piece with blanks, which no state stops at
+            memset(tail, ' ', sizeof(tail));
+            memcpy(tail, chunk, n);
+            chunk = tail;
+        }
+        ChunkMasks m;
+        chunk_masks(chunk, &m);
+        uint64_t valid = n == 64 ? ~(uint64_t)0 : ((uint64_t)1 << n) - 1;
+
+        unsigned pos = 0;
+        while (pos < n) {
+            const LangSkip *skip = &lang->skip[state];
+            if (skip->mark) {
+                // Settle the lines ending before the next byte that matters
+                uint64_t ahead = valid & (~(uint64_t)0 << pos);
+                uint64_t stops = stop_mask(chunk, skip) & ahead;
+                uint64_t span = stops ? ahead & ((stops & -stops) - 1) : ahead;
+                uint64_t newlines = m.newline & span;
+                uint64_t text = m.text & span;
+                while (newlines) {
+                    uint64_t before = (newlines & -newlines) - 1;
+                    if (text & before) flags |= skip->mark;
+                    counts[kind_of[flags]]++;
+                    flags = 0;
+                    text &= ~before;
+                    newlines &= newlines - 1;
+                }
+                if (text) flags |= skip->mark;
+                if (!stops) break;
+                pos = (unsigned)__builtin_ctzll(stops);
+            }
+
+            unsigned char c = chunk[pos++];
+            unsigned t = lang->next[state * (unsigned)lang->classes + lang->byte_class[c]];
+            flags |= t >> LANG_MARK_SHIFT;
+            state = t & LANG_STATE_MASK;
+            if (c == '\n') {
+                counts[kind_of[flags]]++;
+                flags = 0;
+            }
+        }
+    }
+
+    scan->kinds.code += counts[0];
+    scan->kinds.comment += counts[1];
+    scan->kinds.blank += counts[2];
+    scan->lines += counts[0] + counts[1] + counts[2];
+    scan->state = state;
+    scan->line_flags = flags;
+}
+
+
+// Adds one block of file contents to the running count
+void scan_block(LineScan *scan, const unsigned char *buf, size_t len) {
+    if (len == 0) return;
+    scan->has_content = 1;      // File is not empty
+    scan->bytes += (long)len;
+    if (scan->lang)
+        classify_block(scan, buf, len);
+    else
+        scan->lines += (long)count_newlines(buf, len);
+    if (scan->hashing) content_hash_update(&scan->hash, buf, len);
+    scan->last_char_was_newline = buf[len - 1] == '\n';
+}
+
+// Returns the --dedup content hash of a finished scan, or 0 without --dedup
+uint64_t scan_content_hash(const LineScan *scan) {
+    return scan->hashing ? content_hash_finish(&scan->hash) : 0;
+}
+
+// Returns the final line count of a finished scan
+long scan_finish(const LineScan *scan) {
+    // If file has content but does not end in newline, count the last line
+    if (scan->has_content && !scan->last_char_was_newline)
+        return scan->lines + 1;
+    return scan->lines;
+}
+
+// Returns the lines of a finished --classify scan by kind, including an
+// unterminated last line (settled as if a newline followed)
+LineKinds scan_kinds(const LineScan *scan) {
+    LineKinds kinds = scan->kinds;
+    if (scan->lang && scan->has_content && !scan->last_char_was_newline) {
+        const LangDfa *lang = scan->lang;
+        unsigned t = lang->next[scan->state * (unsigned)lang->classes + lang->byte_class['\n']];
+        unsigned flags = scan->line_flags | t >> LANG_MARK_SHIFT;
+        if (flags & MARK_CODE)
+            kinds.code++;
+        else if (flags & MARK_COMMENT)
+            kinds.comment++;
+        else
+            kinds.blank++;
+    }
+    return kinds;
+}
+
+
+// ---------------------------------------------------------------------------
+// Splitting huge files (--split-size)
+//
+// One huge file found late leaves a single thread reading it while the
+// others sit idle. A file of at least --split-size bytes is therefore cut
+// into SPLIT_RANGE_SIZE ranges that any idle thread can claim: its reader
+// publishes the job, counts ranges itself, and when none is left waits for
+// the helpers to finish the ones they took, so the caller gets an ordinary
+// finished scan. Newline counts of the ranges simply add up; only the last
+// byte of the file decides the "last line without a newline" rule, and
+// whoever reads it records it. --classify needs the lexer state at the
+// start of every range, so classified files are never split.
+// ---------------------------------------------------------------------------
+
+#define SPLIT_RANGE_SIZE (8 * 1024 * 1024)
+#define DEFAULT_SPLIT_SIZE (64 * 1024 * 1024)
+#define SPLIT_MAX_JOBS 64  // Files being split at once; more are read whole
+
+typedef struct {
+    int fd;
+    off_t start;               // First byte of range 0
+    off_t end;                 // File size
+    size_t ranges;
+    size_t next_range;         // First range nobody has claimed
+    int users;                 // Helpers inside the job
+    long newlines;             // Over finished ranges
+    long bytes;                // Actually read over finished ranges
+    int last_newline;          // Whether the last byte is '\n'
+    int error;                 // errno of a failed pread(), or 0
+} SplitJob;
+
+static size_t split_size = DEFAULT_SPLIT_SIZE;  // --split-size; 0 = never
+static int split_helpers = 0;    // Whether other threads exist to help
+static pthread_mutex_t split_lock = PTHREAD_MUTEX_INITIALIZER;
+static SplitJob *split_jobs[SPLIT_MAX_JOBS];  // Jobs open for helpers
+static int split_job_count;
+
+
+// Counts the newlines of one range of a split file: with --io=mmap the
+// range is mapped on its own (ranges start at multiples of the page size,
+// as 'start' is 0 or READ_BUFFER_SIZE), otherwise it is pread() in pieces
+void split_count_range(SplitJob *job, size_t range, unsigned char *read_buf) {
+    off_t offset = job->start + (off_t)range * SPLIT_RANGE_SIZE;
+    off_t end = job->end - offset > SPLIT_RANGE_SIZE ? offset + SPLIT_RANGE_SIZE : job->end;
+    off_t first = offset;
+    long newlines = 0;
+
+    if (io_mode == IO_MMAP) {
+        size_t len = (size_t)(end - offset);
+        unsigned char *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, job->fd, offset);
+        if (map != MAP_FAILED) {
+            madvise(map, len, MADV_SEQUENTIAL);
+            newlines = (long)count_newlines(map, len);
+            if (end == job->end) job->last_newline = map[len - 1] == '\n';
+            munmap(map, len);
+            __atomic_add_fetch(&job->newlines, newlines, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&job->bytes, (long)len, __ATOMIC_RELAXED);
+            return;
+        }
+        // Cannot be mapped after all: read it
+    }
+    while (offset < end) {
+        size_t want = end - offset < READ_BUFFER_SIZE ? (size_t)(end - offset) : READ_BUFFER_SIZE;
+        ssize_t n = pread(job->fd, read_buf, want, offset);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            __atomic_store_n(&job->error, errno, __ATOMIC_RELAXED);
+            break;
+        }
+        if (n == 0) break;  // The file shrank
+        newlines += (long)count_newlines(read_buf, (size_t)n);
+        offset += n;
+        if (offset == job->end) job->last_newline = read_buf[n - 1] == '\n';
+    }
+    __atomic_add_fetch(&job->newlines, newlines, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&job->bytes, (long)(offset - first), __ATOMIC_RELAXED);
+}
+
+
+// Claims and counts ranges of a split file until none is left
+void split_work(SplitJob *job, unsigned char *read_buf) {
+    size_t range;
+    while ((range = __atomic_fetch_add(&job->next_range, 1, __ATOMIC_RELAXED)) < job->ranges)
+        split_count_range(job, range, read_buf);
+}
+
+
+// Lets a thread with nothing better to do count ranges of a file being
+// split; returns 1 if it helped, 0 if there was nothing to claim
+int help_split(unsigned char *read_buf) {
+    if (__atomic_load_n(&split_job_count, __ATOMIC_RELAXED) == 0) return 0;
+
+    SplitJob *job = NULL;
+    pthread_mutex_lock(&split_lock);
+    for (int i = 0; i < split_job_count && !job; i++)
+        if (__atomic_load_n(&split_jobs[i]->next_range, __ATOMIC_RELAXED) < split_jobs[i]->ranges)
+            job = split_jobs[i];
+    if (job) __atomic_add_fetch(&job->users, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&split_lock);
+    if (!job) return 0;
+
+    split_work(job, read_buf);
+    __atomic_sub_fetch(&job->users, 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+
+// Counts bytes [start, size) of an open file with the help of idle threads
+// and adds them to 'scan'
+// Returns 0 on success, -1 on a read error (already reported)
+int scan_fd_split(int fd, const char *filepath, off_t start, off_t size,
+                  unsigned char *read_buf, LineScan *scan) {
+    SplitJob job = {
+        .fd = fd,
+        .start = start,
+        .end = size,
+        .ranges = (size_t)((size - start + SPLIT_RANGE_SIZE - 1) / SPLIT_RANGE_SIZE),
+        .last_newline = scan->last_char_was_newline,
+    };
+
+    pthread_mutex_lock(&split_lock);
+    int published = split_job_count < SPLIT_MAX_JOBS;
+    if (published) {
+        split_jobs[split_job_count] = &job;
+        __atomic_store_n(&split_job_count, split_job_count + 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&split_lock);
+
+    split_work(&job, read_buf);
+
+    if (published) {
+        // Close the job to newcomers, then wait for the helpers inside it
+        pthread_mutex_lock(&split_lock);
+        int i = 0;
+        while (split_jobs[i] != &job) i++;
+        split_jobs[i] = split_jobs[split_job_count - 1];
+        __atomic_store_n(&split_job_count, split_job_count - 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&split_lock);
+        while (__atomic_load_n(&job.users, __ATOMIC_ACQUIRE) != 0) sched_yield();
+    }
+
+    if (job.error) {
+        errno = job.error;
+        perror(filepath);
+        return -1;
+    }
+    scan->lines += job.newlines;
+    // A file that shrank meanwhile counts only the bytes that were read
+    scan->bytes += job.bytes;
+    if (job.bytes > 0) scan->has_content = 1;
+    scan->last_char_was_newline = job.last_newline;
+    return 0;
+}
+
+
+// Whether a scan may go through scan_fd_split()
+static inline int scan_splittable(const LineScan *scan) {
+    return split_size > 0 && split_helpers && !scan->lang && !scan->hashing;
+}
+
+
+// Reads an open file to EOF through the caller's READ_BUFFER_SIZE buffer.
+// A first read that fills the buffer checks the size, and a file of at
+// least --split-size is handed to scan_fd_split() from there.
+// Returns 0 on success, -1 on a read error (already reported)
+int scan_fd_read(int fd, const char *filepath, unsigned char *read_buf, LineScan *scan) {
+    ssize_t n;
+    off_t offset = 0;
+    while ((n = read(fd, read_buf, READ_BUFFER_SIZE)) != 0) {
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror(filepath);
+            return -1;
+        }
+        scan_block(scan, read_buf, (size_t)n);
+        struct stat st;
+        if (offset == 0 && n == READ_BUFFER_SIZE && scan_splittable(scan) &&
+            fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && (size_t)st.st_size >= split_size)
+            return scan_fd_split(fd, filepath, n, st.st_size, read_buf, scan);
+        offset += n;
+    }
+    return 0;
+}
+
+// Scans an open file without copying it: large files are mapped read-only
+// and counted in place, small ones take a single pread() into the buffer
+// Falls back to scan_fd_read() for anything that cannot be mapped
+int scan_fd_mmap(int fd, const char *filepath, unsigned char *read_buf, LineScan *scan) {
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0)
+        return scan_fd_read(fd, filepath, read_buf, scan);  // Unknown size: just read it
+
+    size_t size = (size_t)st.st_size;
+    if (size >= split_size && scan_splittable(scan))
+        return scan_fd_split(fd, filepath, 0, st.st_size, read_buf, scan);
+
+    // Below the threshold the mapping costs more than copying the bytes
+    if (size < mmap_threshold) {
+        // Normally one call; the loop only matters if the read comes up short
+        ssize_t n;
+        off_t offset = 0;
+        while (offset < (off_t)size && (n = pread(fd, read_buf, READ_BUFFER_SIZE, offset)) != 0) {
+            if (n == -1) {
+                if (errno == EINTR) continue;
+                perror(filepath);
+                return -1;
+            }
+            scan_block(scan, read_buf, (size_t)n);
+            offset += n;
+        }
+        return 0;
+    }
+
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    flags |= MAP_POPULATE;  // Prefault the whole file in one go (Linux)
+#endif
+    void *map = mmap(NULL, size, PROT_READ, flags, fd, 0);
+    if (map == MAP_FAILED)
+        return scan_fd_read(fd, filepath, read_buf, scan);
+
+    madvise(map, size, MADV_SEQUENTIAL);  // Aggressive read-ahead, early drop
+    scan_block(scan, map, size);
+    munmap(map, size);
+    return 0;
+}
+
+
+// Opens a text file and counts how many newline characters it contains
+// This is used to determine the number of lines in a .c or .h file
+// The file is opened relative to its directory ('dir_fd', 'name'); the full
+// 'filepath' is only used in error messages
+// The contents are fetched according to the --io mode, using the calling
+// thread's scratch buffer, and accumulated into 'scan'
+// Returns 0 on success, -1 if the file could not be opened or read
+int count_lines_in_file(int dir_fd, const char *name, const char *filepath,
+                        unsigned char *read_buf, LineScan *scan) {
+    int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC); // Open the file in read mode
+    if (fd == -1) {
+        perror(filepath);   // Print an error message if opening fails
+        return -1;          // Leave the scan at 0 lines
+    }
+
+    int rc;
+    if (io_mode == IO_MMAP)
+        rc = scan_fd_mmap(fd, filepath, read_buf, scan);
+    else
+        rc = scan_fd_read(fd, filepath, read_buf, scan);
+
+    close(fd);  // MUST close the file
+
+    return rc;
+}
+
+
+// ---------------------------------------------------------------------------
+// Directory nodes and display paths
+// ---------------------------------------------------------------------------
+
+// Recursive totals of a directory for --dirs. Its files add in as they are
+// counted, and every subdirectory adds its own totals once it is finished.
+typedef struct {
+    long lines;
+    long files;
+    long bytes;
+    int pending;             // Unfinished parts: its own scan, subdirectories
+                             // and files still in flight
+} DirRollup;
+
+// A directory on the traversal frontier. Only the entry name is stored; the
+// full path is rebuilt from the parent chain when it has to be displayed,
+// so siblings share their common prefix instead of each copying it.
+// While a directory is open, its children are opened relative to 'fd' with
+// openat(), so no path is ever handed to the kernel and depth is unlimited.
+typedef struct DirNode {
+    struct DirNode *parent;  // NULL for the starting directory
+    int fd;                  // Open directory, -1 once closed
+    int fd_refs;             // Users of 'fd': its scanner, children not yet
+                             // opened, and files still being opened
+    int depth;               // 0 for the starting directory
+    uint64_t dev;            // With --follow, once opened: st_dev and
+    uint64_t ino;            // st_ino, to recognize a link loop
+    DirRollup rollup;        // With --dirs
+    int32_t exclude_state;   // Exclude matcher state after "path/"
+    IgnoreRules *ignore;     // --gitignore rule sets above, NULL if none
+    const int32_t *ignore_states;  // One matcher state per set in 'ignore'
+    size_t name_len;
+    char name[];             // NUL-terminated entry name
+} DirNode;
+
+// Growable string buffer used to assemble paths of any length
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} PathBuf;
+
+// Takes a reference on a directory's open descriptor
+void retain_dir_fd(DirNode *node) {
+    __atomic_add_fetch(&node->fd_refs, 1, __ATOMIC_RELAXED);
+}
+
+
+// Drops a reference; the last user closes the directory
+void release_dir_fd(DirNode *node) {
+    if (__atomic_sub_fetch(&node->fd_refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        close(node->fd);
+        node->fd = -1;
+    }
+}
+
+
+// Makes room for at least 'needed' bytes in a path buffer
+void pathbuf_reserve(PathBuf *pb, size_t needed) {
+    if (needed <= pb->cap) return;
+    size_t cap = pb->cap ? pb->cap : MAX_PATH_SIZE;
+    while (cap < needed) cap *= 2;
+    char *data = realloc(pb->data, cap);
+    if (!data) {
+        perror("realloc");
+        exit(1);
+    }
+    pb->data = data;
+    pb->cap = cap;
+}
+
+
+// Writes the full path of a directory node into 'pb' by walking its parents
+const char *dir_node_path(const DirNode *node, PathBuf *pb) {
+    // First pass: measure, so the second pass can fill from the end
+    size_t len = 0;
+    for (const DirNode *n = node; n; n = n->parent)
+        len += n->name_len + (n->parent ? 1 : 0);
+
+    pathbuf_reserve(pb, len + 1);
+    pb->len = len;
+    pb->data[len] = '\0';
+    for (const DirNode *n = node; n; n = n->parent) {
+        len -= n->name_len;
+        memcpy(pb->data + len, n->name, n->name_len);
+        if (n->parent) pb->data[--len] = '/';
+    }
+    return pb->data;
+}
+
+
+// Sets 'pb' to "<dir>/<name>", reusing an already built directory path
+const char *join_path(PathBuf *pb, const PathBuf *dir, const char *name) {
+    size_t name_len = strlen(name);
+    pathbuf_reserve(pb, dir->len + 1 + name_len + 1);
+    memcpy(pb->data, dir->data, dir->len);
+    pb->data[dir->len] = '/';
+    memcpy(pb->data + dir->len + 1, name, name_len + 1);
+    pb->len = dir->len + 1 + name_len;
+    return pb->data;
+}
+
+
+// ---------------------------------------------------------------------------
+// Workers
+// ---------------------------------------------------------------------------
+
+// Bump allocator for DirNodes; chunks are only released when the walk ends,
+// so nodes can be handed to other workers freely
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    size_t used;
+    char data[];
+} ArenaChunk;
+
+// Ring buffer of pending directories owned by one worker
+typedef struct {
+    pthread_mutex_t lock;  // Held briefly by the owner and by thieves
+    DirNode **items;
+    size_t head;           // Index of the oldest entry (the steal end)
+    size_t count;
+    size_t cap;
+} DirDeque;
+
+// A directory remembered for the --stats "largest directories" list
+typedef struct {
+    unsigned long entries;
+    unsigned long batches;
+    char *path;
+} DirSample;
+
+// Traversal counters, kept per worker and summed at the end
+typedef struct {
+    unsigned long dirs;          // Directories scanned
+    unsigned long entries;       // Entries listed, not counting . and ..
+    unsigned long dir_batches;   // getdents64() calls (readdir() calls elsewhere)
+    unsigned long stat_calls;    // fstatat() calls
+    unsigned long files;         // Files counted
+    unsigned long cache_hits;    // Files answered by the --cache file unopened
+    unsigned long ignored;       // Entries skipped by --gitignore rules
+    unsigned long links_skipped; // Symbolic links not followed
+    unsigned long repeats;       // Directories and files whose inode was seen before
+    unsigned long index_entries; // Entries read from .git/index with --git-index
+    unsigned long blobs;         // Distinct blobs counted with --rev
+    unsigned long objects;       // Git objects inflated with --rev
+    unsigned long dir_histogram[DIR_HISTOGRAM_BUCKETS];  // Entries per directory, log2
+    DirSample largest[STATS_TOP_DIRS];                    // Sorted, largest first
+} WalkStats;
+
+// One cached file count in the --cache file. The first seven fields are
+// the key: a file is only trusted while its inode, size, mtime and ctime
+// are all unchanged. 64 bytes, so records never straddle cache lines.
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;         // 0 marks an empty slot
+    int64_t size;
+    int64_t mtime_sec;
+    int64_t ctime_sec;
+    int32_t mtime_nsec;
+    int32_t ctime_nsec;
+    int64_t lines;
+    uint64_t content_hash;  // --dedup hash of the contents, 0 if not taken
+} CacheRecord;
+
+// Formatted per-file lines waiting to be written to stdout
+typedef struct {
+    char *data;   // OUTPUT_BUFFER_SIZE bytes
+    size_t len;
+} OutBuf;
+
+// Totals of the files with one --ext extension, for --by-ext and --by-lang
+typedef struct {
+    long files;
+    long lines;
+    long bytes;
+    LineKinds kinds;             // With --classify
+} ExtTotals;
+
+// Per-thread traversal state
+typedef struct Worker {
+    int id;
+    pthread_t thread;
+    DirDeque deque;
+    ArenaChunk *arena;         // Nodes for the directories this worker found
+    PathBuf dir_path;          // Display path of 'dir_path_node', built lazily
+    const DirNode *dir_path_node;
+    PathBuf entry_path;        // Display path of the entry being reported
+    long total_lines;          // Lines counted by this worker only
+    long unique_lines;         // With --dedup: of files whose contents were new
+    long duplicate_files;      // With --dedup: files whose contents were not
+    LineKinds kinds;           // The same lines by kind, with --classify
+    ExtTotals *by_ext;         // Per --ext extension, with --by-ext/--by-lang
+    unsigned char *read_buf;   // READ_BUFFER_SIZE scratch buffer
+    unsigned char *dirent_buf; // DIRENT_BUFFER_SIZE getdents64() buffer
+#ifdef LINEBOLT_HAVE_URING
+    struct UringEngine *uring; // Per-thread ring in --io=uring mode
+#endif
+    WalkStats stats;
+    OutBuf out;                // This worker's pending result lines
+    CacheRecord *cache_log;    // Counts to write back to the --cache file
+    size_t cache_log_len;
+    size_t cache_log_cap;
+    int32_t *ignore_scratch;   // Child matcher states while judging a directory
+    int ignore_scratch_cap;
+#ifdef LINEBOLT_HAVE_ZLIB
+    struct GitReader *git;     // Object reader in --rev mode
+#endif
+} Worker;
+
+static Worker *workers;
+static int worker_count;
+static int walker_count;       // Workers that walk: all, or the --walkers
+static int use_pipeline = 0;   // Walkers and counters are separate threads
+
+// Directories pushed but not yet fully scanned, across all workers; the
+// walk is complete once this drops to zero
+static long pending_dirs;
+
+// Set when a starting directory or file could not be counted
+static int operand_failed;
+
+// All workers' counters, summed by walk_directory() for --stats
+static WalkStats run_stats;
+
+// All workers' lines by kind, for the --classify summary
+static LineKinds run_kinds;
+
+// All workers' --dedup results: lines of first copies, and later copies
+static long run_unique_lines;
+static long run_duplicate_files;
+
+// All workers' per-extension totals, for --by-ext and --by-lang
+static ExtTotals *run_by_ext;
+
+
+// ---------------------------------------------------------------------------
+// Persistent count cache (--cache=FILE)
+//
+// The cache file is a header followed by an open-addressing table of
+// fixed-size CacheRecords, hashed by (st_dev, st_ino) with linear probing.
+// It is mapped read-only at startup and probed lock-free by all workers; on
+// a hit the file is never opened. Every count seen during the run (hits
+// included) is logged per worker, and the table is rebuilt from those logs
+// at exit and renamed over the old file, so deleted files drop out.
+// ---------------------------------------------------------------------------
+
+#define CACHE_MAGIC "LBCACHE"
+#define CACHE_VERSION 2  // 2: records carry the --dedup content hash
+#define CACHE_BYTE_ORDER 0x01020304u
+
+typedef struct {
+    char magic[8];         // CACHE_MAGIC, NUL-padded
+    uint32_t version;      // CACHE_VERSION
+    uint32_t record_size;  // sizeof(CacheRecord)
+    uint32_t byte_order;   // CACHE_BYTE_ORDER as written by this machine
+    uint32_t reserved0;
+    uint64_t capacity;     // Number of slots, a power of two
+    uint64_t count;        // Occupied slots
+    uint64_t reserved[3];  // Pads the header to 64 bytes
+} CacheHeader;
+
+static void *cache_map;                 // Whole mapped file, NULL if none
+static size_t cache_map_size;
+static const CacheRecord *cache_table;  // Slots following the header
+static uint64_t cache_capacity;
+
+// Files whose ctime is this recent may still be changing within the same
+// timestamp tick, so their counts are not stored (like git's racy check)
+static time_t cache_racy_after;
+
+
+// Mixes (dev, ino) into a slot index
+uint64_t cache_hash(uint64_t dev, uint64_t ino) {
+    uint64_t h = ino * 0x9e3779b97f4a7c15ULL ^ (dev + 0x632be59bd9b4e019ULL);
+    h ^= h >> 31;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    return h ^ (h >> 29);
+}
+
+
+// Fills the key fields of a record from a stat result
+void cache_key_from_stat(CacheRecord *key, const struct stat *st) {
+    key->dev = (uint64_t)st->st_dev;
+    key->ino = (uint64_t)st->st_ino;
+    key->size = (int64_t)st->st_size;
+#ifdef __APPLE__
+    key->mtime_sec = st->st_mtimespec.tv_sec;
+    key->mtime_nsec = st->st_mtimespec.tv_nsec;
+    key->ctime_sec = st->st_ctimespec.tv_sec;
+    key->ctime_nsec = st->st_ctimespec.tv_nsec;
+#else
+    key->mtime_sec = st->st_mtim.tv_sec;
+    key->mtime_nsec = st->st_mtim.tv_nsec;
+    key->ctime_sec = st->st_ctim.tv_sec;
+    key->ctime_nsec = st->st_ctim.tv_nsec;
+#endif
+    key->lines = 0;
+    key->content_hash = 0;
+}
+
+
+// Looks a file up in the mapped cache. With --dedup, a record without a
+// content hash does not do: the file has to be read for it.
+// Returns 1 and sets '*lines' and '*content_hash' if an unchanged record
+// exists, 0 otherwise
+int cache_lookup(const CacheRecord *key, long *lines, uint64_t *content_hash) {
+    if (!cache_table) return 0;
+    uint64_t mask = cache_capacity - 1;
+    uint64_t i = cache_hash(key->dev, key->ino) & mask;
+    // A damaged file may lie about its count: never probe past a full lap
+    for (uint64_t probes = 0; probes < cache_capacity; probes++, i = (i + 1) & mask) {
+        const CacheRecord *rec = &cache_table[i];
+        if (rec->ino == 0) return 0;
+        if (rec->ino != key->ino || rec->dev != key->dev) continue;
+        if (rec->size != key->size ||
+            rec->mtime_sec != key->mtime_sec || rec->mtime_nsec != key->mtime_nsec ||
+            rec->ctime_sec != key->ctime_sec || rec->ctime_nsec != key->ctime_nsec)
+            return 0;  // Same inode, but the file changed
+        if (dedup_files && rec->content_hash == 0) return 0;
+        *lines = (long)rec->lines;
+        *content_hash = rec->content_hash;
+        return 1;
+    }
+    return 0;
+}
+
+
+// Logs a count (and content hash, or 0) for the next cache file, unless
+// the file is too fresh
+void cache_remember(Worker *w, const CacheRecord *key, long lines, uint64_t content_hash) {
+    if (key->ctime_sec >= cache_racy_after || key->mtime_sec >= cache_racy_after) return;
+    if (w->cache_log_len == w->cache_log_cap) {
+        size_t cap = w->cache_log_cap ? w->cache_log_cap * 2 : 1024;
+        CacheRecord *log = realloc(w->cache_log, cap * sizeof(*log));
+        if (!log) return;  // Losing a cache entry only costs a recount
+        w->cache_log = log;
+        w->cache_log_cap = cap;
+    }
+    CacheRecord *rec = &w->cache_log[w->cache_log_len++];
+    *rec = *key;
+    rec->lines = lines;
+    rec->content_hash = content_hash;
+}
+
+
+// Maps an existing cache file; a missing or foreign file means starting
+// with an empty cache
+void cache_load(const char *path) {
+    // Anything changed within a second of now is treated as racy
+    cache_racy_after = time(NULL) - 1;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        if (errno != ENOENT) perror(path);
+        return;
+    }
+
+    struct stat st;
+    const CacheHeader *hdr = NULL;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(CacheHeader)) {
+        cache_map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (cache_map == MAP_FAILED) cache_map = NULL;
+        else cache_map_size = (size_t)st.st_size;
+        hdr = cache_map;
+    }
+    close(fd);
+
+    if (!hdr || memcmp(hdr->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+        hdr->version != CACHE_VERSION || hdr->record_size != sizeof(CacheRecord) ||
+        hdr->byte_order != CACHE_BYTE_ORDER || hdr->capacity == 0 ||
+        (hdr->capacity & (hdr->capacity - 1)) != 0 ||
+        hdr->count >= hdr->capacity ||  // Probes need a free slot to stop at
+        cache_map_size != sizeof(CacheHeader) + hdr->capacity * sizeof(CacheRecord)) {
+        fprintf(stderr, "linebolt: ignoring unusable cache file %s\n", path);
+        if (cache_map) munmap(cache_map, cache_map_size);
+        cache_map = NULL;
+        return;
+    }
+
+    cache_table = (const CacheRecord *)(hdr + 1);
+    cache_capacity = hdr->capacity;
+    madvise(cache_map, cache_map_size, MADV_RANDOM);  // Probes jump around
+}
+
+
+// Writes every logged count into a fresh table and replaces the cache file
+// Returns 0 on success, -1 after reporting the error
+int cache_save(const char *path, Worker *all, int count) {
+    size_t records = 0;
+    for (int i = 0; i < count; i++) records += all[i].cache_log_len;
+
+    uint64_t capacity = CACHE_MIN_CAPACITY;
+    while (capacity < 2 * (uint64_t)records) capacity *= 2;
+
+    size_t size = sizeof(CacheHeader) + capacity * sizeof(CacheRecord);
+    unsigned char *image = calloc(1, size);
+    if (!image) {
+        perror("calloc");
+        return -1;
+    }
+
+    CacheHeader *hdr = (CacheHeader *)image;
+    memcpy(hdr->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    hdr->version = CACHE_VERSION;
+    hdr->record_size = sizeof(CacheRecord);
+    hdr->byte_order = CACHE_BYTE_ORDER;
+    hdr->capacity = capacity;
+
+    // Insert; an inode seen twice (hard links, followed symlinks) keeps one slot
+    CacheRecord *table = (CacheRecord *)(hdr + 1);
+    for (int i = 0; i < count; i++) {
+        for (size_t r = 0; r < all[i].cache_log_len; r++) {
+            const CacheRecord *rec = &all[i].cache_log[r];
+            uint64_t slot = cache_hash(rec->dev, rec->ino) & (capacity - 1);
+            while (table[slot].ino != 0 && (table[slot].ino != rec->ino || table[slot].dev != rec->dev))
+                slot = (slot + 1) & (capacity - 1);
+            if (table[slot].ino == 0) hdr->count++;
+            table[slot] = *rec;
+        }
+    }
+
+    // Write next to the target and rename, so readers never see half a file
+    size_t tmp_len = strlen(path) + 32;
+    char *tmp = malloc(tmp_len);
+    if (!tmp) {
+        free(image);
+        return -1;
+    }
+    snprintf(tmp, tmp_len, "%s.tmp.%ld", path, (long)getpid());
+
+    int rc = -1;
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd != -1) {
+        size_t done = 0;
+        while (done < size) {
+            ssize_t n = write(fd, image + done, size - done);
+            if (n == -1) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            done += (size_t)n;
+        }
+        if (close(fd) == 0 && done == size && rename(tmp, path) == 0) rc = 0;
+    }
+    if (rc != 0) {
+        perror(path);
+        unlink(tmp);
+    }
+
+    free(tmp);
+    free(image);
+    return rc;
+}
+
+
+// ---------------------------------------------------------------------------
+// Seen sets (--follow, --unique-inodes, --dedup)
+//
+// Following symbolic links turns the tree into a graph: a link back to an
+// ancestor would be walked forever, and a link to a sibling walks the same
+// files twice. Loops are cut by comparing each directory with its own
+// ancestors. With --unique-inodes every directory is also recorded by
+// (st_dev, st_ino) once it is opened, and one that was already seen is
+// skipped, so each is walked once however many paths lead to it; the same
+// goes for files, which also catches hard links. --dedup records every
+// file's (size, content hash).
+//
+// A set holds pairs of 64-bit words and is split into shards by hash, each
+// an open-addressing table with linear probing behind its own lock, so
+// threads rarely wait on each other. A slot is 16 bytes and tables grow at
+// half full, which keeps even a multi-million-file tree to some tens of
+// megabytes.
+// ---------------------------------------------------------------------------
+
+#define PAIR_SHARDS 64  // A power of two
+#define PAIR_SHARD_MIN_CAPACITY 256
+
+typedef struct {
+    uint64_t a;
+    uint64_t b;              // 0 marks a free slot
+} PairKey;
+
+typedef struct {
+    pthread_mutex_t lock;
+    PairKey *slots;
+    size_t capacity;         // A power of two, or 0 before the first insert
+    size_t count;
+} __attribute__((aligned(64))) PairShard;
+
+typedef struct {
+    PairShard shards[PAIR_SHARDS];
+} PairSet;
+
+static int follow_links = 1;    // --follow (default) / --no-follow
+static int unique_inodes = 0;   // --unique-inodes
+static PairSet visited_dirs;    // (st_dev, st_ino) with --follow --unique-inodes
+static PairSet visited_files;   // (st_dev, st_ino) with --unique-inodes
+static PairSet dedup_set;       // (size, content hash) with --dedup
+
+
+// Sets up an empty set
+void pair_set_init(PairSet *set) {
+    for (int i = 0; i < PAIR_SHARDS; i++) {
+        PairShard *shard = &set->shards[i];
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->slots = NULL;
+        shard->capacity = shard->count = 0;
+    }
+}
+
+
+// Places a key known to be absent into a table with a free slot
+static void pair_shard_place(PairKey *slots, size_t capacity, uint64_t hash, PairKey key) {
+    size_t i = hash & (capacity - 1);
+    while (slots[i].b != 0) i = (i + 1) & (capacity - 1);
+    slots[i] = key;
+}
+
+
+// Adds (a, b) to the set. A 'b' of 0 (no inode number, no content hash)
+// is never stored, and never counts as seen.
+// Returns 1 if it was not there yet, 0 if it was already seen
+int pair_set_add(PairSet *set, uint64_t a, uint64_t b) {
+    PairKey key = {a, b};
+    if (key.b == 0) return 1;
+    uint64_t hash = cache_hash(key.a, key.b);
+    // The low bits pick the slot, so the shard comes from the high ones
+    PairShard *shard = &set->shards[hash >> 58 & (PAIR_SHARDS - 1)];
+
+    pthread_mutex_lock(&shard->lock);
+    if (2 * (shard->count + 1) > shard->capacity) {
+        size_t capacity = shard->capacity ? 2 * shard->capacity : PAIR_SHARD_MIN_CAPACITY;
+        PairKey *slots = calloc(capacity, sizeof(*slots));
+        if (!slots) {
+            perror("calloc");
+            exit(1);
+        }
+        for (size_t i = 0; i < shard->capacity; i++)
+            if (shard->slots[i].b != 0)
+                pair_shard_place(slots, capacity, cache_hash(shard->slots[i].a, shard->slots[i].b),
+                                 shard->slots[i]);
+        free(shard->slots);
+        shard->slots = slots;
+        shard->capacity = capacity;
+    }
+
+    int added = 1;
+    for (size_t i = hash & (shard->capacity - 1);; i = (i + 1) & (shard->capacity - 1)) {
+        PairKey *slot = &shard->slots[i];
+        if (slot->b == 0) {
+            *slot = key;
+            shard->count++;
+            break;
+        }
+        if (slot->b == key.b && slot->a == key.a) {
+            added = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return added;
+}
+
+
+// ---------------------------------------------------------------------------
+// Result output
+//
+// Each worker formats its "%6ld lines  %s\n" records by hand into a large
+// private buffer, with no stdio and no locking. A full buffer is written
+// with a single writev(); only that write is serialized between threads,
+// so records from different workers never interleave mid-line.
+// ---------------------------------------------------------------------------
+
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Writes the buffered lines plus an optional extra tail straight to stdout
+void out_flush(OutBuf *ob, const char *tail, size_t tail_len) {
+    struct iovec iov[2] = {
+        {ob->data, ob->len},
+        {(void *)tail, tail_len},
+    };
+    struct iovec *v = iov;
+    int count = tail_len ? 2 : 1;
+    if (ob->len == 0) {
+        v++;
+        count--;
+    }
+
+    pthread_mutex_lock(&output_lock);
+    while (count > 0) {
+        ssize_t n = writev(STDOUT_FILENO, v, count);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            break;  // stdout is gone (closed pipe); drop the output
+        }
+        // Step past whatever was written; partial writes are rare but legal
+        while (count > 0 && (size_t)n >= v->iov_len) {
+            n -= (ssize_t)v->iov_len;
+            v++;
+            count--;
+        }
+        if (count > 0) {
+            v->iov_base = (char *)v->iov_base + n;
+            v->iov_len -= (size_t)n;
+        }
+    }
+    pthread_mutex_unlock(&output_lock);
+    ob->len = 0;
+}
+
+
+// Writes 'value' right-aligned in a field of at least 'width' characters
+// Returns the number of characters written
+size_t format_count(char *dst, long value, int width) {
+    char digits[24];
+    int n = 0;
+    unsigned long v = value < 0 ? 0UL - (unsigned long)value : (unsigned long)value;
+    do {
+        digits[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    if (value < 0) digits[n++] = '-';
+
+    size_t len = 0;
+    for (int pad = width - n; pad > 0; pad--) dst[len++] = ' ';
+    while (n > 0) dst[len++] = digits[--n];
+    return len;
+}
+
+
+// Appends the label 'text' at 'p' and returns the position after it
+static inline char *put_label(char *p, const char *text) {
+    size_t len = strlen(text);
+    memcpy(p, text, len);
+    return p + len;
+}
+
+
+// Formats the part of a result line in front of the path: "%6ld lines  ",
+// or with a --classify breakdown "%6ld lines %6ld code %6ld comment ..."
+// Writes at most FILE_PREFIX_MAX bytes; returns the number written
+#define FILE_PREFIX_MAX (4 * 24 + 40)
+size_t format_file_prefix(char *dst, long file_lines, const LineKinds *kinds) {
+    char *p = dst + format_count(dst, file_lines, 6);
+    if (kinds) {
+        p = put_label(p, " lines ");
+        p += format_count(p, kinds->code, 6);
+        p = put_label(p, " code ");
+        p += format_count(p, kinds->comment, 6);
+        p = put_label(p, " comment ");
+        p += format_count(p, kinds->blank, 6);
+        p = put_label(p, " blank  ");
+    } else {
+        p = put_label(p, " lines  ");
+    }
+    return (size_t)(p - dst);
+}
+
+
+// Appends one "%6ld lines  %s\n" record (with the line kinds if 'kinds' is
+// not NULL); a path too long for the buffer goes out in the same writev()
+// without being copied
+void out_file_line(OutBuf *ob, long file_lines, const LineKinds *kinds, const char *filepath) {
+    size_t path_len = strlen(filepath);
+
+    if (ob->len + FILE_PREFIX_MAX + path_len + 1 > OUTPUT_BUFFER_SIZE) {
+        if (FILE_PREFIX_MAX + path_len + 1 > OUTPUT_BUFFER_SIZE) {
+            // Giant path: format the prefix, then send path and newline as-is
+            if (ob->len + FILE_PREFIX_MAX > OUTPUT_BUFFER_SIZE) out_flush(ob, NULL, 0);
+            ob->len += format_file_prefix(ob->data + ob->len, file_lines, kinds);
+            out_flush(ob, filepath, path_len);
+            out_flush(ob, "\n", 1);
+            return;
+        }
+        out_flush(ob, NULL, 0);
+    }
+
+    char *p = ob->data + ob->len;
+    p += format_file_prefix(p, file_lines, kinds);
+    memcpy(p, filepath, path_len);
+    p += path_len;
+    *p++ = '\n';
+    ob->len = (size_t)(p - ob->data);
+}
+
+
+// Appends one --dirs record, "%8ld lines %6ld files %12ld bytes  %s\n"
+void out_dir_line(OutBuf *ob, long lines, long files, long bytes, const char *dirpath) {
+    char prefix[3 * 24 + 32];
+    char *p = prefix + format_count(prefix, lines, 8);
+    p = put_label(p, " lines ");
+    p += format_count(p, files, 6);
+    p = put_label(p, " files ");
+    p += format_count(p, bytes, 12);
+    p = put_label(p, " bytes  ");
+
+    size_t prefix_len = (size_t)(p - prefix), path_len = strlen(dirpath);
+    if (ob->len + prefix_len + path_len + 1 > OUTPUT_BUFFER_SIZE) out_flush(ob, NULL, 0);
+    if (prefix_len + path_len + 1 > OUTPUT_BUFFER_SIZE) {
+        memcpy(ob->data, prefix, prefix_len);
+        ob->len = prefix_len;
+        out_flush(ob, dirpath, path_len);
+        out_flush(ob, "\n", 1);
+        return;
+    }
+    memcpy(ob->data + ob->len, prefix, prefix_len);
+    memcpy(ob->data + ob->len + prefix_len, dirpath, path_len);
+    ob->len += prefix_len + path_len;
+    ob->data[ob->len++] = '\n';
+}
+
+
+// Records the per-file result line and adds it to the worker's own total,
+// so no locking is needed. 'ext' is the file's --ext extension, 'bytes' its
+// size, 'kinds' the --classify breakdown, or NULL, and 'content_hash' the
+// --dedup hash, or 0 if there is none. With --dirs only the directories
+// are listed.
+void report_file(Worker *w, const char *filepath, int ext, long file_lines, long bytes,
+                 const LineKinds *kinds, uint64_t content_hash) {
+    if (!dir_rollups) out_file_line(&w->out, file_lines, kinds, filepath);
+    w->total_lines += file_lines;
+    if (dedup_files) {
+        // The size goes into the key too: same-sized files are the only
+        // candidates, and a table probe compares the size first
+        if (bytes == 0 || pair_set_add(&dedup_set, (uint64_t)bytes, content_hash))
+            w->unique_lines += file_lines;
+        else
+            w->duplicate_files++;
+    }
+    if (kinds) {
+        w->kinds.code += kinds->code;
+        w->kinds.comment += kinds->comment;
+        w->kinds.blank += kinds->blank;
+    }
+    if (w->by_ext) {
+        // Indexed by extension: no lookup beyond the suffix match already done
+        ExtTotals *t = &w->by_ext[ext];
+        t->files++;
+        t->lines += file_lines;
+        t->bytes += bytes;
+        if (kinds) {
+            t->kinds.code += kinds->code;
+            t->kinds.comment += kinds->comment;
+            t->kinds.blank += kinds->blank;
+        }
+    }
+}
+
+
+// Adds a counted file to the --dirs totals of its directory. Other threads
+// add finished subdirectories into the same node, hence the atomics.
+void rollup_add(DirNode *dir, long lines, long bytes) {
+    __atomic_add_fetch(&dir->rollup.lines, lines, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&dir->rollup.files, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&dir->rollup.bytes, bytes, __ATOMIC_RELAXED);
+}
+
+
+// Whether --dirs lists a directory: within --depth, and holding matching
+// files unless it is the starting directory
+static inline int rollup_shown(int depth, long files) {
+    return (max_depth < 0 || depth <= max_depth) && (files > 0 || depth == 0);
+}
+
+
+// Drops one pending part of a directory. Whoever finishes it reports the
+// directory and adds its totals to the parent, which may finish in turn,
+// so totals flow up as subtrees complete.
+void rollup_release(Worker *w, DirNode *node) {
+    while (node && __atomic_sub_fetch(&node->rollup.pending, 1, __ATOMIC_ACQ_REL) == 0) {
+        const DirRollup *r = &node->rollup;
+        if (rollup_shown(node->depth, r->files))
+            out_dir_line(&w->out, r->lines, r->files, r->bytes, dir_node_path(node, &w->entry_path));
+        DirNode *parent = node->parent;
+        if (parent) {
+            __atomic_add_fetch(&parent->rollup.lines, r->lines, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&parent->rollup.files, r->files, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&parent->rollup.bytes, r->bytes, __ATOMIC_RELAXED);
+        }
+        node = parent;
+    }
+}
+
+
+#ifdef LINEBOLT_HAVE_URING
+// ---------------------------------------------------------------------------
+// io_uring backend (--io=uring)
+//
+// Instead of counting each file as the walker finds it, matching files are
+// queued into a fixed set of slots. Every slot walks through
+// OPENAT -> READ_FIXED ... -> CLOSE as its completions arrive, so up to
+// URING_SLOTS files are in flight and one io_uring_enter() call submits and
+// reaps a whole batch. Reads land in buffers registered once at startup.
+// The ring is driven through raw syscalls; no liburing is needed.
+// ---------------------------------------------------------------------------
+
+// Life cycle of one in-flight file
+enum uring_stage {
+    SLOT_FREE,
+    SLOT_OPENING,  // OPENAT submitted
+    SLOT_READING   // READ_FIXED submitted
+};
+
+typedef struct {
+    enum uring_stage stage;
+    int fd;
+    off_t offset;
+    off_t size;              // From the --cache key's stat, or -1 if unknown
+    LineScan scan;
+    int ext;                 // --ext extension of the file
+    DirNode *dir;            // Directory the file is opened relative to
+    char name[NAME_MAX + 1]; // Must outlive the OPENAT, so it is copied here
+    int failed;              // A read failed; the count must not be cached
+    int cacheable;           // 'key' is valid and the count goes to --cache
+    CacheRecord key;
+} UringSlot;
+
+typedef struct UringEngine {
+    int ring_fd;
+
+    // Submission queue ring, shared with the kernel
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_entries;
+
+    // Completion queue ring, shared with the kernel
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_map, *cq_map;
+    size_t sq_map_size, cq_map_size;
+
+    unsigned inflight;      // Operations submitted and not yet completed
+    int free_slots;
+    Worker *owner;          // Worker that finished files are reported to
+    PathBuf dir_path;       // Scratch space for display paths
+    PathBuf file_path;
+    UringSlot slots[URING_SLOTS];
+    unsigned char *buffers; // URING_SLOTS registered buffers, back to back
+} UringEngine;
+
+// user_data tag for CLOSE completions, which need no follow-up work
+#define URING_CLOSE_TAG ((__u64)-1)
+
+// Thin wrappers around the io_uring system calls
+int sys_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+int sys_io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+int sys_io_uring_register(int ring_fd, unsigned opcode, const void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+
+// Creates the ring, maps its queues and registers the read buffers
+// Returns 0 on success, -1 if io_uring is unavailable (errno is set)
+int uring_init(UringEngine *u, Worker *owner) {
+    memset(u, 0, sizeof(*u));
+    u->ring_fd = -1;
+    u->owner = owner;
+
+    // Room for one OPENAT or READ per slot plus a CLOSE per slot
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = sys_io_uring_setup(2 * URING_SLOTS, &params);
+    if (fd < 0) return -1;
+    u->ring_fd = fd;
+
+    u->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    u->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cq_map_size > u->sq_map_size) u->sq_map_size = u->cq_map_size;
+        u->cq_map_size = u->sq_map_size;
+    }
+
+    u->sq_map = mmap(NULL, u->sq_map_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (u->sq_map == MAP_FAILED) goto fail;
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        u->cq_map = u->sq_map;
+    } else {
+        u->cq_map = mmap(NULL, u->cq_map_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (u->cq_map == MAP_FAILED) goto fail;
+    }
+
+    u->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) goto fail;
+
+    char *sq = u->sq_map, *cq = u->cq_map;
+    u->sq_head = (unsigned *)(sq + params.sq_off.head);
+    u->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    u->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    u->sq_array = (unsigned *)(sq + params.sq_off.array);
+    u->sq_entries = params.sq_entries;
+    u->cq_head = (unsigned *)(cq + params.cq_off.head);
+    u->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    u->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    // Register the buffer pool once so reads skip per-I/O page pinning
+    u->buffers = mmap(NULL, (size_t)URING_SLOTS * URING_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (u->buffers == MAP_FAILED) goto fail;
+
+    struct iovec iov[URING_SLOTS];
+    for (int i = 0; i < URING_SLOTS; i++) {
+        iov[i].iov_base = u->buffers + (size_t)i * URING_BUFFER_SIZE;
+        iov[i].iov_len = URING_BUFFER_SIZE;
+    }
+    if (sys_io_uring_register(fd, IORING_REGISTER_BUFFERS, iov, URING_SLOTS) < 0) goto fail;
+
+    u->free_slots = URING_SLOTS;
+    return 0;
+
+fail:
+    close(fd);  // Tears down the ring; mappings are reclaimed at exit
+    u->ring_fd = -1;
+    return -1;
+}
+
+
+// Number of SQEs written to the ring that the kernel has not consumed yet
+unsigned uring_unsubmitted(UringEngine *u) {
+    return *u->sq_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+}
+
+
+// Reserves the next submission queue entry, flushing the queue if it is full
+struct io_uring_sqe *uring_get_sqe(UringEngine *u) {
+    while (uring_unsubmitted(u) >= u->sq_entries)
+        sys_io_uring_enter(u->ring_fd, uring_unsubmitted(u), 0, 0);
+
+    unsigned tail = *u->sq_tail;
+
+    unsigned index = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_array[index] = index;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->inflight++;
+    return sqe;
+}
+
+
+// Queues the next READ_FIXED for a slot at its current offset
+void uring_prep_read(UringEngine *u, int slot_index) {
+    UringSlot *slot = &u->slots[slot_index];
+    struct io_uring_sqe *sqe = uring_get_sqe(u);
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->fd = slot->fd;
+    sqe->addr = (__u64)(uintptr_t)(u->buffers + (size_t)slot_index * URING_BUFFER_SIZE);
+    sqe->len = URING_BUFFER_SIZE;
+    sqe->off = (__u64)slot->offset;
+    sqe->buf_index = (__u16)slot_index;
+    sqe->user_data = (__u64)slot_index;
+    slot->stage = SLOT_READING;
+}
+
+
+// Queues an asynchronous close; the slot does not wait for it
+void uring_prep_close(UringEngine *u, int fd) {
+    struct io_uring_sqe *sqe = uring_get_sqe(u);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = fd;
+    sqe->user_data = URING_CLOSE_TAG;
+}
+
+
+// Builds the display path of a slot's file
+const char *uring_slot_path(UringEngine *u, const UringSlot *slot) {
+    dir_node_path(slot->dir, &u->dir_path);
+    return join_path(&u->file_path, &u->dir_path, slot->name);
+}
+
+
+// Finishes a slot: closes its file, reports the count and frees the slot
+void uring_finish_slot(UringEngine *u, UringSlot *slot) {
+    if (slot->fd >= 0) uring_prep_close(u, slot->fd);
+    long lines = scan_finish(&slot->scan);
+    uint64_t content_hash = slot->failed ? 0 : scan_content_hash(&slot->scan);
+    if (slot->cacheable && !slot->failed) cache_remember(u->owner, &slot->key, lines, content_hash);
+    LineKinds kinds = scan_kinds(&slot->scan);
+    report_file(u->owner, uring_slot_path(u, slot), slot->ext, lines, slot->scan.bytes,
+                classify_lines ? &kinds : NULL, content_hash);
+    if (dir_rollups) {
+        rollup_add(slot->dir, lines, slot->scan.bytes);
+        rollup_release(u->owner, slot->dir);
+    }
+    slot->stage = SLOT_FREE;
+    u->free_slots++;
+}
+
+
+// Advances the slot a completion belongs to by one step
+void uring_handle_cqe(UringEngine *u, const struct io_uring_cqe *cqe) {
+    u->inflight--;
+    if (cqe->user_data == URING_CLOSE_TAG) return;
+
+    int slot_index = (int)cqe->user_data;
+    UringSlot *slot = &u->slots[slot_index];
+
+    // Once OPENAT is done the directory descriptor is no longer needed
+    if (slot->stage == SLOT_OPENING)
+        release_dir_fd(slot->dir);
+
+    if (cqe->res < 0) {
+        // Same message perror() would have produced for the failed call
+        fprintf(stderr, "%s: %s\n", uring_slot_path(u, slot), strerror(-cqe->res));
+        if (slot->stage == SLOT_OPENING) {
+            slot->stage = SLOT_FREE;  // Nothing was opened and nothing counted
+            u->free_slots++;
+        } else {
+            slot->failed = 1;
+            uring_finish_slot(u, slot);
+        }
+        return;
+    }
+
+    if (slot->stage == SLOT_OPENING) {
+        slot->fd = cqe->res;
+        uring_prep_read(u, slot_index);
+        return;
+    }
+
+    // A read completed: count it, then read on or finish at EOF. Reads may
+    // come up short anywhere (network file systems do), so only a zero read
+    // is EOF; reaching a size already known from stat saves that last read.
+    unsigned n = (unsigned)cqe->res;
+    scan_block(&slot->scan, u->buffers + (size_t)slot_index * URING_BUFFER_SIZE, n);
+    slot->offset += n;
+    if (n > 0 && (slot->size < 0 || slot->offset < slot->size))
+        uring_prep_read(u, slot_index);
+    else
+        uring_finish_slot(u, slot);
+}
+
+
+// Submits everything queued and processes completions, waiting for at
+// least 'wait_for' of them
+void uring_submit_and_reap(UringEngine *u, unsigned wait_for) {
+    unsigned to_submit = uring_unsubmitted(u);
+    if (to_submit || wait_for)
+        sys_io_uring_enter(u->ring_fd, to_submit, wait_for, wait_for ? IORING_ENTER_GETEVENTS : 0);
+
+    unsigned head = *u->cq_head;
+    unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe cqe = u->cqes[head & *u->cq_mask];
+        head++;
+        // Release the CQE before handling it, as handling may submit more work
+        __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+        uring_handle_cqe(u, &cqe);
+        tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    }
+}
+
+
+// Hands a file (by directory and name, with its --ext extension) to the ring; blocks on completions
+// only when all slots are busy. 'key' (may be NULL) is the file's --cache key.
+void uring_queue_file(UringEngine *u, DirNode *dir, const char *name, int ext, const CacheRecord *key) {
+    // Also wait while closes pile up, so completions never outrun the CQ ring
+    while (u->free_slots == 0 || u->inflight >= u->sq_entries)
+        uring_submit_and_reap(u, 1);
+
+    int slot_index = 0;
+    while (u->slots[slot_index].stage != SLOT_FREE) slot_index++;
+
+    UringSlot *slot = &u->slots[slot_index];
+    slot->stage = SLOT_OPENING;
+    slot->fd = -1;
+    slot->offset = 0;
+    scan_start(&slot->scan, ext);
+    slot->ext = ext;
+    slot->dir = dir;
+    snprintf(slot->name, sizeof(slot->name), "%s", name);
+    slot->failed = 0;
+    slot->cacheable = key != NULL;
+    slot->size = key ? (off_t)key->size : -1;
+    if (key) slot->key = *key;
+    retain_dir_fd(dir);  // Keep the directory open until OPENAT completes
+    if (dir_rollups) __atomic_add_fetch(&dir->rollup.pending, 1, __ATOMIC_RELAXED);
+    u->free_slots--;
+
+    struct io_uring_sqe *sqe = uring_get_sqe(u);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = dir->fd;
+    sqe->addr = (__u64)(uintptr_t)slot->name;
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    sqe->user_data = (__u64)slot_index;
+
+    // Let a batch build up before paying for the system call
+    if (uring_unsubmitted(u) >= URING_SLOTS / 2)
+        uring_submit_and_reap(u, 0);
+}
+
+
+// Waits until every queued file has been counted and closed
+void uring_drain(UringEngine *u) {
+    while (u->inflight > 0)
+        uring_submit_and_reap(u, 1);
+}
+#endif // LINEBOLT_HAVE_URING
+
+
+// ---------------------------------------------------------------------------
+// Directory enumeration
+//
+// On Linux, directories are read with raw getdents64() calls into a large
+// per-thread buffer, so a directory with 100k entries takes a handful of
+// system calls instead of the hundreds readdir()'s 32 KiB refills need.
+// Elsewhere the reader wraps a readdir() stream.
+// ---------------------------------------------------------------------------
+
+#ifdef LINEBOLT_HAVE_GETDENTS
+// Record layout returned by getdents64()
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
+
+// One entry handed to the walker; 'name' is valid until the next call
+typedef struct {
+    const char *name;
+    unsigned char type;  // DT_* value, DT_UNKNOWN if the filesystem has none
+} DirEntry;
+
+typedef struct {
+#ifdef LINEBOLT_HAVE_GETDENTS
+    int fd;
+    unsigned char *buf;  // DIRENT_BUFFER_SIZE bytes owned by the worker
+    size_t len;          // Bytes filled by the last getdents64() call
+    size_t pos;          // Offset of the next record
+#else
+    DIR *stream;
+#endif
+    unsigned long batches;  // Kernel calls made to list the directory
+} DirReader;
+
+
+// Starts listing an open directory; 'dir_fd' itself stays open and usable
+// Returns 0 on success, -1 on error (errno is set)
+int dir_reader_open(DirReader *r, int dir_fd, unsigned char *buf) {
+    r->batches = 0;
+#ifdef LINEBOLT_HAVE_GETDENTS
+    r->fd = dir_fd;
+    r->buf = buf;
+    r->len = r->pos = 0;
+    return 0;
+#else
+    (void)buf;
+    // The stream gets its own descriptor, so dir_fd outlives closedir()
+    int stream_fd = dup(dir_fd);
+    if (stream_fd == -1) return -1;
+    r->stream = fdopendir(stream_fd);
+    if (!r->stream) {
+        close(stream_fd);
+        return -1;
+    }
+    return 0;
+#endif
+}
+
+
+// Fetches the next entry, refilling the batch buffer when it runs dry
+// Returns 1 with '*entry' filled, 0 at the end, -1 on error (errno is set)
+int dir_reader_next(DirReader *r, DirEntry *entry) {
+#ifdef LINEBOLT_HAVE_GETDENTS
+    if (r->pos >= r->len) {
+        long n = syscall(SYS_getdents64, r->fd, r->buf, DIRENT_BUFFER_SIZE);
+        r->batches++;
+        if (n <= 0) return n == 0 ? 0 : -1;
+        r->len = (size_t)n;
+        r->pos = 0;
+    }
+    const struct linux_dirent64 *d = (const struct linux_dirent64 *)(r->buf + r->pos);
+    r->pos += d->d_reclen;
+    entry->name = d->d_name;
+    entry->type = d->d_type;
+    return 1;
+#else
+    errno = 0;
+    struct dirent *d = readdir(r->stream);
+    r->batches++;
+    if (!d) return errno ? -1 : 0;
+    entry->name = d->d_name;
+    entry->type = d->d_type;
+    return 1;
+#endif
+}
+
+
+// Finishes a listing (the directory descriptor is left to its owner)
+void dir_reader_close(DirReader *r) {
+#ifndef LINEBOLT_HAVE_GETDENTS
+    closedir(r->stream);
+#else
+    (void)r;
+#endif
+}
+
+
+// ---------------------------------------------------------------------------
+// Parallel work-stealing traversal
+//
+// Every worker owns a deque of directories still to be scanned. A worker
+// pushes the subdirectories it finds onto the back of its own deque and pops
+// from the back too, so each thread walks depth-first through a subtree it
+// has just touched. A worker whose deque runs dry steals from the front of
+// another worker's deque, taking the oldest entry, which is usually the root
+// of the largest unexplored subtree. Line totals are kept per worker and
+// summed once all threads have finished.
+// ---------------------------------------------------------------------------
+
+// Returns the number of CPUs this process may run on, honoring affinity
+// masks (taskset, cgroup cpusets) where the platform exposes them
+int usable_cpu_count(void) {
+#if defined(__linux__) && defined(CPU_COUNT)
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0)
+        return CPU_COUNT(&set);
+#endif
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+
+// Carves 'size' bytes out of the worker's arena; blocks live until the
+// walk is over
+void *arena_alloc(Worker *w, size_t size) {
+    size = (size + _Alignof(DirNode) - 1) & ~(size_t)(_Alignof(DirNode) - 1);
+
+    ArenaChunk *chunk = w->arena;
+    if (!chunk || chunk->used + size > ARENA_CHUNK_SIZE) {
+        // Oversized names get a chunk of their own
+        size_t data_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+        chunk = malloc(sizeof(ArenaChunk) + data_size);
+        if (!chunk) {
+            perror("malloc");
+            exit(1);
+        }
+        chunk->next = w->arena;
+        chunk->used = 0;
+        w->arena = chunk;
+    }
+
+    void *block = chunk->data + chunk->used;
+    chunk->used += size;
+    return block;
+}
+
+
+// Allocates a DirNode from the worker's arena and links it to its parent
+DirNode *new_dir_node(Worker *w, DirNode *parent, const char *name, size_t name_len) {
+    DirNode *node = arena_alloc(w, sizeof(DirNode) + name_len + 1);
+    node->parent = parent;
+    node->fd = -1;
+    node->fd_refs = 0;
+    node->depth = parent ? parent->depth + 1 : 0;
+    node->dev = node->ino = 0;
+    node->rollup = (DirRollup){.pending = 1};  // The node's own scan
+    node->name_len = name_len;
+    memcpy(node->name, name, name_len);
+    node->name[name_len] = '\0';
+    return node;
+}
+
+
+// Releases every chunk of a worker's arena
+void free_arena(Worker *w) {
+    while (w->arena) {
+        ArenaChunk *next = w->arena->next;
+        free(w->arena);
+        w->arena = next;
+    }
+}
+
+
+// Adds a directory to the back (owner end) of a worker's deque
+void deque_push(DirDeque *dq, DirNode *node) {
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count == dq->cap) {
+        // Grow and unwrap the ring so entries stay in order
+        size_t new_cap = dq->cap ? dq->cap * 2 : DEQUE_INITIAL_CAPACITY;
+        DirNode **items = malloc(new_cap * sizeof(*items));
+        if (!items) {
+            perror("malloc");
+            exit(1);
+        }
+        for (size_t i = 0; i < dq->count; i++)
+            items[i] = dq->items[(dq->head + i) % dq->cap];
+        free(dq->items);
+        dq->items = items;
+        dq->head = 0;
+        dq->cap = new_cap;
+    }
+    dq->items[(dq->head + dq->count) % dq->cap] = node;
+    dq->count++;
+    pthread_mutex_unlock(&dq->lock);
+}
+
+
+// Takes the newest directory from the owner end; NULL if empty
+DirNode *deque_pop(DirDeque *dq) {
+    DirNode *node = NULL;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count > 0) {
+        dq->count--;
+        node = dq->items[(dq->head + dq->count) % dq->cap];
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return node;
+}
+
+
+// Takes the oldest directory from the steal end; NULL if empty
+DirNode *deque_steal(DirDeque *dq) {
+    DirNode *node = NULL;
+    // Thieves back off instead of queueing behind the owner
+    if (pthread_mutex_trylock(&dq->lock) != 0) return NULL;
+    if (dq->count > 0) {
+        node = dq->items[dq->head];
+        dq->head = (dq->head + 1) % dq->cap;
+        dq->count--;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return node;
+}
+
+
+// Queues a directory (a child of 'parent', or the root if NULL) for
+// scanning on the given worker. The parent stays open until the child
+// has been opened relative to it. 'exclude_state' is where the exclude
+// matcher continues for the directory's own entries, and 'ignore_states'
+// the same for every --gitignore rule set in 'ignore' (copied here).
+void push_directory(Worker *w, DirNode *parent, const char *name, int32_t exclude_state,
+                    IgnoreRules *ignore, const int32_t *ignore_states) {
+    DirNode *node = new_dir_node(w, parent, name, strlen(name));
+    node->exclude_state = exclude_state;
+    node->ignore = ignore;
+    node->ignore_states = NULL;
+    if (ignore) {
+        size_t size = (size_t)(ignore->depth + 1) * sizeof(int32_t);
+        int32_t *states = arena_alloc(w, size);
+        memcpy(states, ignore_states, size);
+        node->ignore_states = states;
+        ignore_rules_retain(ignore);
+    }
+    if (parent) retain_dir_fd(parent);
+    if (parent && dir_rollups) __atomic_add_fetch(&parent->rollup.pending, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&pending_dirs, 1, __ATOMIC_RELAXED);
+    deque_push(&w->deque, node);
+}
+
+
+// Tries every other walker once, starting after 'w', for a directory to steal
+DirNode *steal_directory(Worker *w) {
+    for (int i = 1; i < walker_count; i++) {
+        Worker *victim = &workers[(w->id + i) % walker_count];
+        DirNode *node = deque_steal(&victim->deque);
+        if (node) return node;
+    }
+    return NULL;
+}
+
+
+// Returns the display path of 'name' inside 'node', building the
+// directory's part only once per directory
+const char *entry_display_path(Worker *w, const DirNode *node, const char *name) {
+    if (w->dir_path_node != node) {
+        dir_node_path(node, &w->dir_path);
+        w->dir_path_node = node;
+    }
+    return join_path(&w->entry_path, &w->dir_path, name);
+}
+
+
+// Opens a queued directory relative to its parent's descriptor (the root
+// by its path) and drops the reference the child held on the parent
+// Returns 0 on success, -1 after reporting the error or if the directory
+// was already walked
+int open_dir_node(Worker *w, DirNode *node) {
+    int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+    int fd = node->parent ? openat(node->parent->fd, node->name, flags)
+                          : open(node->name, flags);
+    int saved_errno = errno;
+    if (node->parent) release_dir_fd(node->parent);
+
+    if (fd == -1) {
+        errno = saved_errno;
+        // Print error and skip if directory can't be opened
+        perror(dir_node_path(node, &w->entry_path));
+        if (!node->parent) __atomic_store_n(&operand_failed, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    // With --follow, a link back to one of its own ancestors is a loop
+    // and not walked again. With --unique-inodes too, neither is any
+    // directory reached before through another path.
+    struct stat st;
+    if (follow_links && fstat(fd, &st) == 0) {
+        node->dev = (uint64_t)st.st_dev;
+        node->ino = (uint64_t)st.st_ino;
+        int seen = 0;
+        for (const DirNode *n = node->parent; n && !seen; n = n->parent)
+            seen = n->ino == node->ino && n->dev == node->dev;
+        if (!seen && unique_inodes) seen = !pair_set_add(&visited_dirs, node->dev, node->ino);
+        if (seen) {
+            w->stats.repeats++;
+            close(fd);
+            return -1;
+        }
+    }
+    node->fd = fd;
+    node->fd_refs = 1;  // Held by the scan itself
+    return 0;
+}
+
+
+// Adds one scanned directory to the worker's counters
+void record_dir_stats(Worker *w, const DirNode *node, unsigned long entries, unsigned long batches) {
+    WalkStats *st = &w->stats;
+    st->dirs++;
+    st->entries += entries;
+    st->dir_batches += batches;
+
+    int bucket = 0;
+    while (bucket < DIR_HISTOGRAM_BUCKETS - 1 && (entries >> bucket) > 0) bucket++;
+    st->dir_histogram[bucket]++;
+
+    // Keep the largest directories; the path is only built for a newcomer
+    DirSample *last = &st->largest[STATS_TOP_DIRS - 1];
+    if (!show_stats || entries <= last->entries) return;
+    free(last->path);
+    int i = STATS_TOP_DIRS - 1;
+    while (i > 0 && st->largest[i - 1].entries < entries) {
+        st->largest[i] = st->largest[i - 1];
+        i--;
+    }
+    st->largest[i].entries = entries;
+    st->largest[i].batches = batches;
+    st->largest[i].path = strdup(dir_node_path(node, &w->entry_path));
+}
+
+
+// What the walker needs to know about a directory entry
+enum entry_kind {
+    ENTRY_OTHER,  // Devices, sockets, dangling links, ... (skipped)
+    ENTRY_DIR,
+    ENTRY_FILE
+};
+
+// Classifies a directory entry, trusting d_type when the filesystem fills
+// it in. Only DT_UNKNOWN costs an fstatat() relative to the open directory.
+// Symbolic links are resolved with a second one, or skipped with --no-follow.
+// When a stat was needed anyway, it is left in '*st' and '*have_st' is set.
+enum entry_kind classify_entry(Worker *w, const DirNode *node, const DirEntry *entry,
+                               struct stat *st, int *have_st) {
+    int flags;
+    *have_st = 0;
+    switch (entry->type) {
+    case DT_DIR:
+        return ENTRY_DIR;
+    case DT_REG:
+        return ENTRY_FILE;
+    case DT_LNK:
+        if (!follow_links) {
+            w->stats.links_skipped++;
+            return ENTRY_OTHER;
+        }
+        flags = 0;                    // Follow the link to its target
+        break;
+    case DT_UNKNOWN:
+        flags = AT_SYMLINK_NOFOLLOW;  // Find out what the entry itself is
+        break;
+    default:
+        return ENTRY_OTHER;
+    }
+
+    w->stats.stat_calls++;
+    if (fstatat(node->fd, entry->name, st, flags) == -1) {
+        perror(entry_display_path(w, node, entry->name));
+        return ENTRY_OTHER;
+    }
+    if (S_ISLNK(st->st_mode)) {
+        if (!follow_links) {
+            w->stats.links_skipped++;
+            return ENTRY_OTHER;
+        }
+        w->stats.stat_calls++;
+        if (fstatat(node->fd, entry->name, st, 0) == -1) {
+            perror(entry_display_path(w, node, entry->name));
+            return ENTRY_OTHER;
+        }
+    }
+    *have_st = 1;
+    if (S_ISDIR(st->st_mode)) return ENTRY_DIR;
+    if (S_ISREG(st->st_mode)) return ENTRY_FILE;
+    return ENTRY_OTHER;
+}
+
+
+// Counts one file of an open directory, or hands it to the worker's
+// io_uring. 'key' (may be NULL) is the file's --cache key.
+void count_dir_file(Worker *w, DirNode *node, const char *name, int ext, const CacheRecord *key) {
+#ifdef LINEBOLT_HAVE_URING
+    if (w->uring) {
+        // Counted on completion
+        uring_queue_file(w->uring, node, name, ext, key);
+        return;
+    }
+#endif
+    // The display path is only built for files we actually report
+    const char *fullpath = entry_display_path(w, node, name);
+    LineScan scan;
+    scan_start(&scan, ext);
+    int rc = count_lines_in_file(node->fd, name, fullpath, w->read_buf, &scan);
+    long file_lines = scan_finish(&scan);
+    uint64_t content_hash = rc == 0 ? scan_content_hash(&scan) : 0;
+    if (key && rc == 0) cache_remember(w, key, file_lines, content_hash);
+    LineKinds kinds = scan_kinds(&scan);
+    report_file(w, fullpath, ext, file_lines, scan.bytes, classify_lines ? &kinds : NULL, content_hash);
+    if (dir_rollups) rollup_add(node, file_lines, scan.bytes);
+}
+
+
+// ---------------------------------------------------------------------------
+// Walker/counter pipeline (--walkers / --counters)
+//
+// By default every worker both walks and counts, so a thread is either
+// waiting on directory metadata or on file contents. With --walkers and
+// --counters the two run as separate stages: walker threads only list
+// directories and filter entries, and push every matching file onto a
+// bounded lock-free queue; counter threads pop files and open and scan
+// them. Each stage gets its own thread count, and on high-latency storage
+// the metadata and the read traffic overlap instead of alternating.
+//
+// The queue is Dmitry Vyukov's bounded MPMC array: every cell carries a
+// sequence number that tells producers and consumers whether it is free or
+// filled for their lap, so a push or pop is one compare-and-swap on the
+// shared position and no lock is ever taken. A queued file holds a
+// reference on its directory's descriptor (and --dirs rollup) until it is
+// counted, like a file in flight on io_uring.
+//
+// Walkers stat every file they queue, and there is one queue per size
+// class. Counters always take from the class of the largest files first,
+// an approximation of longest-processing-time-first scheduling: a big file
+// starts as soon as it is found instead of turning up last and leaving one
+// thread busy while the others are done.
+// ---------------------------------------------------------------------------
+
+#define FILE_QUEUE_SIZE 1024  // Cells per size class; a power of two
+#define FILE_QUEUE_CLASSES 4  // >= 16 MiB, >= 1 MiB, >= 64 KiB, smaller
+
+typedef struct {
+    DirNode *dir;
+    int ext;                  // --ext extension
+    int cacheable;            // 'key' is valid and the count goes to --cache
+    CacheRecord key;
+    char name[NAME_MAX + 1];
+} FileItem;
+
+typedef struct {
+    size_t sequence;          // == position: free for that push;
+    FileItem item;            // == position + 1: filled for that pop
+} FileCell;
+
+// Queue positions, each on a cache line of its own
+typedef struct {
+    size_t pos;
+    char pad[64 - sizeof(size_t)];
+} QueueCursor;
+
+typedef struct {
+    FileCell *cells;
+    QueueCursor head;
+    QueueCursor tail;
+} FileQueue;
+
+static FileQueue file_queues[FILE_QUEUE_CLASSES];  // Largest files first
+static int walker_threads = 0;   // --walkers
+static int counter_threads = 0;  // --counters
+static int walkers_running;      // Walkers still scanning; counters stop at 0
+
+
+// Sets up the empty queues
+void file_queue_init(void) {
+    for (int c = 0; c < FILE_QUEUE_CLASSES; c++) {
+        FileQueue *q = &file_queues[c];
+        q->cells = malloc(FILE_QUEUE_SIZE * sizeof(*q->cells));
+        if (!q->cells) {
+            perror("malloc");
+            exit(1);
+        }
+        for (size_t i = 0; i < FILE_QUEUE_SIZE; i++) q->cells[i].sequence = i;
+        q->head.pos = q->tail.pos = 0;
+    }
+}
+
+
+// Returns the queue for a file of 'size' bytes
+FileQueue *file_queue_for(off_t size) {
+    int c = size >= 16 << 20 ? 0 : size >= 1 << 20 ? 1 : size >= 64 << 10 ? 2 : 3;
+    return &file_queues[c];
+}
+
+
+// Appends an item; returns 0 if the queue is full
+int file_queue_push(FileQueue *q, const FileItem *item) {
+    size_t pos = __atomic_load_n(&q->tail.pos, __ATOMIC_RELAXED);
+    for (;;) {
+        FileCell *cell = &q->cells[pos & (FILE_QUEUE_SIZE - 1)];
+        size_t seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            // The cell is free for this lap: claim the position
+            if (__atomic_compare_exchange_n(&q->tail.pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                cell->item = *item;
+                __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+                return 1;
+            }
+        } else if (diff < 0) {
+            return 0;  // Still holds the item from the previous lap
+        } else {
+            pos = __atomic_load_n(&q->tail.pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+
+// Removes the oldest item into '*item'; returns 0 if the queue is empty
+int file_queue_pop(FileQueue *q, FileItem *item) {
+    size_t pos = __atomic_load_n(&q->head.pos, __ATOMIC_RELAXED);
+    for (;;) {
+        FileCell *cell = &q->cells[pos & (FILE_QUEUE_SIZE - 1)];
+        size_t seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&q->head.pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *item = cell->item;
+                // Free the cell for the push one lap ahead
+                __atomic_store_n(&cell->sequence, pos + FILE_QUEUE_SIZE, __ATOMIC_RELEASE);
+                return 1;
+            }
+        } else if (diff < 0) {
+            return 0;  // Not filled yet
+        } else {
+            pos = __atomic_load_n(&q->head.pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+
+// Waits a little longer the longer a thread has found nothing to do
+void idle_backoff(int *idle_rounds) {
+    if (++*idle_rounds < 64) {
+        sched_yield();
+    } else {
+        struct timespec pause = {0, 50000};  // 50 us
+        nanosleep(&pause, NULL);
+    }
+}
+
+
+// Takes the queued file of the largest size class; returns 0 if none is queued
+int file_queue_take(FileItem *item) {
+    for (int c = 0; c < FILE_QUEUE_CLASSES; c++)
+        if (file_queue_pop(&file_queues[c], item)) return 1;
+    return 0;
+}
+
+
+// Hands a matching file of 'size' bytes in an open directory to the
+// counters, waiting while its queue is full. 'key' (may be NULL) is the
+// file's --cache key.
+void queue_file(DirNode *dir, const char *name, int ext, off_t size, const CacheRecord *key) {
+    FileItem item;
+    item.dir = dir;
+    item.ext = ext;
+    item.cacheable = key != NULL;
+    if (key) item.key = *key;
+    snprintf(item.name, sizeof(item.name), "%s", name);
+
+    retain_dir_fd(dir);  // Until the counter has opened the file
+    if (dir_rollups) __atomic_add_fetch(&dir->rollup.pending, 1, __ATOMIC_RELAXED);
+    FileQueue *q = file_queue_for(size);
+    int idle_rounds = 0;
+    while (!file_queue_push(q, &item)) idle_backoff(&idle_rounds);
+}
+
+
+// Main loop of a counter thread: count queued files until the walkers are
+// done and the queue is drained
+void *counter_main(void *arg) {
+    Worker *w = arg;
+    int idle_rounds = 0;
+    FileItem item;
+
+    for (;;) {
+        // Read before popping: once no walker runs, an empty queue stays empty
+        int walk_done = __atomic_load_n(&walkers_running, __ATOMIC_ACQUIRE) == 0;
+        if (help_split(w->read_buf)) {
+            idle_rounds = 0;
+            continue;
+        }
+        if (file_queue_take(&item)) {
+            idle_rounds = 0;
+            count_dir_file(w, item.dir, item.name, item.ext, item.cacheable ? &item.key : NULL);
+            release_dir_fd(item.dir);
+            if (dir_rollups) rollup_release(w, item.dir);
+            continue;
+        }
+        if (walk_done) break;
+#ifdef LINEBOLT_HAVE_URING
+        if (w->uring) uring_drain(w->uring);
+#endif
+        idle_backoff(&idle_rounds);
+    }
+
+#ifdef LINEBOLT_HAVE_URING
+    if (w->uring) uring_drain(w->uring);
+#endif
+    out_flush(&w->out, NULL, 0);
+    return NULL;
+}
+
+
+// Scans one directory: subdirectories are queued on this worker's deque,
+// matching files are counted (or handed to the worker's io_uring, or to
+// the counter threads)
+void scan_directory(Worker *w, DirNode *node) {
+    if (open_dir_node(w, node) != 0) {
+        ignore_rules_release(node->ignore);
+        return;
+    }
+
+    // With --gitignore, this directory's own ignore files go on top of the
+    // rule sets it inherited; the scan holds the reference the node had
+    IgnoreRules *rules = node->ignore;
+    const int32_t *states = node->ignore_states;
+    if (use_ignore_files) {
+        IgnoreRules *own = ignore_rules_push(node->fd, rules, ignore_file_names);
+        if (own != rules) {
+            int32_t *extended = arena_alloc(w, (size_t)(own->depth + 1) * sizeof(int32_t));
+            if (rules) memcpy(extended, states, (size_t)own->depth * sizeof(int32_t));
+            extended[own->depth] = GLOB_START;
+            rules = own;
+            states = extended;
+        }
+        if (rules && rules->depth >= w->ignore_scratch_cap) {
+            w->ignore_scratch_cap = rules->depth + 16;
+            w->ignore_scratch = realloc(w->ignore_scratch,
+                                        (size_t)w->ignore_scratch_cap * sizeof(int32_t));
+            if (!w->ignore_scratch) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+    }
+
+    DirReader reader;
+    if (dir_reader_open(&reader, node->fd, w->dirent_buf) != 0) {
+        perror(dir_node_path(node, &w->entry_path));
+        ignore_rules_release(rules);
+        release_dir_fd(node);
+        return;
+    }
+
+    DirEntry entry;
+    unsigned long entries = 0;
+    int rc;
+
+    // Iterate over entries in the current directory
+    while ((rc = dir_reader_next(&reader, &entry)) > 0) {
+        const char *name = entry.name;
+
+        // Skip "." and ".." entries to avoid infinite recursion
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            continue;
+        entries++;
+
+        // Regular files and links whose name we would reject anyway need no
+        // metadata at all; only directories have to be told apart from them
+        int ext = match_extension(name);
+        if (ext < 0 && entry.type == DT_REG) continue;
+
+        struct stat st;
+        int have_st;
+        enum entry_kind kind = classify_entry(w, node, &entry, &st, &have_st);
+
+        // If it's a directory, push it onto our deque to process later
+        if (kind == ENTRY_DIR) {
+            int32_t state = exclude_dir_state(node->exclude_state, name);
+            if (state < 0) continue;
+            if (rules && ignore_entry(rules, states, name, 1, w->ignore_scratch)) {
+                w->stats.ignored++;
+                continue;
+            }
+            push_directory(w, node, name, state, rules, w->ignore_scratch);
+        }
+
+        // If it's a regular file and a .c or .h file, count its lines
+        else if (kind == ENTRY_FILE && ext >= 0) {
+            if (rules && ignore_entry(rules, states, name, 0, NULL)) {
+                w->stats.ignored++;
+                continue;
+            }
+
+            // With --unique-inodes, a file reached before (a hard link, or
+            // through a followed link) is counted only the first time
+            if (unique_inodes) {
+                if (!have_st) {
+                    w->stats.stat_calls++;
+                    if (fstatat(node->fd, name, &st, 0) == -1) {
+                        perror(entry_display_path(w, node, name));
+                        continue;
+                    }
+                    have_st = 1;
+                }
+                if (!pair_set_add(&visited_files, st.st_dev, st.st_ino)) {
+                    w->stats.repeats++;
+                    continue;
+                }
+            }
+            w->stats.files++;
+
+            // With --cache, an unchanged file is answered from its metadata
+            CacheRecord key;
+            if (cache_path) {
+                if (!have_st) {
+                    w->stats.stat_calls++;
+                    if (fstatat(node->fd, name, &st, 0) == -1) {
+                        perror(entry_display_path(w, node, name));
+                        continue;
+                    }
+                    have_st = 1;
+                }
+                cache_key_from_stat(&key, &st);
+                long cached_lines;
+                uint64_t cached_hash;
+                if (cache_lookup(&key, &cached_lines, &cached_hash)) {
+                    w->stats.cache_hits++;
+                    cache_remember(w, &key, cached_lines, cached_hash);
+                    report_file(w, entry_display_path(w, node, name), ext, cached_lines, (long)key.size,
+                                NULL, cached_hash);
+                    if (dir_rollups) rollup_add(node, cached_lines, (long)key.size);
+                    continue;
+                }
+            }
+
+            if (use_pipeline) {
+                // Walkers have the time to stat: the counters go by size
+                if (!have_st) {
+                    w->stats.stat_calls++;
+                    if (fstatat(node->fd, name, &st, 0) == -1) {
+                        perror(entry_display_path(w, node, name));
+                        continue;
+                    }
+                }
+                queue_file(node, name, ext, st.st_size, cache_path ? &key : NULL);
+            } else
+                count_dir_file(w, node, name, ext, cache_path ? &key : NULL);
+        }
+    }
+
+    if (rc < 0) perror(dir_node_path(node, &w->entry_path));
+    dir_reader_close(&reader);
+    record_dir_stats(w, node, entries, reader.batches);
+    ignore_rules_release(rules);
+    release_dir_fd(node);
+}
+
+
+// Files named on the command line. They count as pending work like the
+// directories, so idle workers stay around to help split a huge one.
+typedef struct {
+    const char *path;
+    int ext;                  // --ext extension
+    CacheRecord key;          // With --cache
+} FileOperand;
+
+static FileOperand *operand_files;
+static size_t operand_file_count;
+static size_t operand_cursor;  // Next file no worker has claimed yet
+
+
+// Counts the next file named on the command line, through --cache like a
+// walked file. With --dirs it gets a row of its own, as it belongs to no
+// directory that is listed.
+// Returns 1 if it counted one, 0 once all of them are claimed
+int count_operand_file(Worker *w) {
+    if (__atomic_load_n(&operand_cursor, __ATOMIC_RELAXED) >= operand_file_count) return 0;
+    size_t i = __atomic_fetch_add(&operand_cursor, 1, __ATOMIC_RELAXED);
+    if (i >= operand_file_count) return 0;
+
+    const FileOperand *f = &operand_files[i];
+    w->stats.files++;
+    long file_lines, bytes;
+    long cached_lines;
+    uint64_t cached_hash;
+    if (cache_path && cache_lookup(&f->key, &cached_lines, &cached_hash)) {
+        w->stats.cache_hits++;
+        cache_remember(w, &f->key, cached_lines, cached_hash);
+        file_lines = cached_lines;
+        bytes = (long)f->key.size;
+        report_file(w, f->path, f->ext, file_lines, bytes, NULL, cached_hash);
+    } else {
+        LineScan scan;
+        scan_start(&scan, f->ext);
+        int rc = count_lines_in_file(AT_FDCWD, f->path, f->path, w->read_buf, &scan);
+        if (rc != 0) __atomic_store_n(&operand_failed, 1, __ATOMIC_RELAXED);
+        file_lines = scan_finish(&scan);
+        bytes = scan.bytes;
+        uint64_t content_hash = rc == 0 ? scan_content_hash(&scan) : 0;
+        if (cache_path && rc == 0) cache_remember(w, &f->key, file_lines, content_hash);
+        LineKinds kinds = scan_kinds(&scan);
+        report_file(w, f->path, f->ext, file_lines, bytes, classify_lines ? &kinds : NULL, content_hash);
+    }
+    if (dir_rollups) out_dir_line(&w->out, file_lines, 1, bytes, f->path);
+    __atomic_sub_fetch(&pending_dirs, 1, __ATOMIC_ACQ_REL);
+    return 1;
+}
+
+
+// Main loop of every worker: drain the own deque, then steal, and stop once
+// no directory is queued or being scanned anywhere
+void *worker_main(void *arg) {
+    Worker *w = arg;
+    int idle_rounds = 0;
+
+    for (;;) {
+        // Ranges of a file being split go first: they hold up the tail
+        if (!use_pipeline && help_split(w->read_buf)) {
+            idle_rounds = 0;
+            continue;
+        }
+        if (count_operand_file(w)) {
+            idle_rounds = 0;
+            continue;
+        }
+
+        DirNode *node = deque_pop(&w->deque);
+        if (!node) node = steal_directory(w);
+
+        if (node) {
+            idle_rounds = 0;
+            scan_directory(w, node);
+            if (dir_rollups) rollup_release(w, node);
+            // Children were counted in before this decrement, so zero
+            // really means the whole tree is done
+            __atomic_sub_fetch(&pending_dirs, 1, __ATOMIC_ACQ_REL);
+            continue;
+        }
+
+#ifdef LINEBOLT_HAVE_URING
+        // Finish our in-flight files before going idle
+        if (w->uring) uring_drain(w->uring);
+#endif
+
+        if (__atomic_load_n(&pending_dirs, __ATOMIC_ACQUIRE) == 0) break;
+
+        // Someone else is still scanning and may produce work: back off
+        idle_backoff(&idle_rounds);
+    }
+
+#ifdef LINEBOLT_HAVE_URING
+    if (w->uring) uring_drain(w->uring);
+#endif
+    out_flush(&w->out, NULL, 0);
+    return NULL;
+}
+
+
+// Sets up one worker's buffers (and io_uring ring when requested)
+// Returns 0 on success, -1 on allocation failure
+int init_worker(Worker *w, int id) {
+    memset(w, 0, sizeof(*w));
+    w->id = id;
+    pthread_mutex_init(&w->deque.lock, NULL);
+    w->read_buf = malloc(READ_BUFFER_SIZE);
+    w->dirent_buf = malloc(DIRENT_BUFFER_SIZE);
+    w->out.data = malloc(OUTPUT_BUFFER_SIZE);
+    if (!w->read_buf || !w->dirent_buf || !w->out.data) return -1;
+    if (breakdown != BREAKDOWN_NONE) {
+        w->by_ext = calloc((size_t)ext_matcher.count, sizeof(*w->by_ext));
+        if (!w->by_ext) return -1;
+    }
+
+#ifdef LINEBOLT_HAVE_URING
+    if (io_mode == IO_URING && !(use_pipeline && id < walker_count)) {  // Not for pipeline walkers
+        w->uring = malloc(sizeof(*w->uring));
+        if (!w->uring) return -1;
+        if (uring_init(w->uring, w) != 0) {
+            // Kernels without io_uring (or with it disabled) get the read() path
+            if (id == 0) perror("linebolt: io_uring unavailable, using --io=read");
+            free(w->uring);
+            w->uring = NULL;
+            io_mode = IO_READ;
+        }
+    }
+#endif
+    return 0;
+}
+
+
+// Adds one worker's counters into 'into', merging the largest-directory lists
+void merge_stats(WalkStats *into, WalkStats *from) {
+    into->dirs += from->dirs;
+    into->entries += from->entries;
+    into->dir_batches += from->dir_batches;
+    into->stat_calls += from->stat_calls;
+    into->files += from->files;
+    into->cache_hits += from->cache_hits;
+    into->ignored += from->ignored;
+    into->links_skipped += from->links_skipped;
+    into->repeats += from->repeats;
+    into->blobs += from->blobs;
+    into->objects += from->objects;
+    for (int b = 0; b < DIR_HISTOGRAM_BUCKETS; b++)
+        into->dir_histogram[b] += from->dir_histogram[b];
+
+    for (int k = 0; k < STATS_TOP_DIRS && from->largest[k].path; k++) {
+        DirSample sample = from->largest[k];
+        DirSample *last = &into->largest[STATS_TOP_DIRS - 1];
+        if (sample.entries <= last->entries) {
+            free(sample.path);
+            continue;
+        }
+        free(last->path);
+        int i = STATS_TOP_DIRS - 1;
+        while (i > 0 && into->largest[i - 1].entries < sample.entries) {
+            into->largest[i] = into->largest[i - 1];
+            i--;
+        }
+        into->largest[i] = sample;
+    }
+}
+
+
+// Prints the --stats instrumentation report to stderr
+void print_stats(const WalkStats *st) {
+    static const char *io_names[] = {"read", "mmap", "uring"};
+    double dirs = st->dirs ? (double)st->dirs : 1.0;
+    double batches = st->dir_batches ? (double)st->dir_batches : 1.0;
+
+    fprintf(stderr, "\n----- linebolt stats -----\n");
+    fprintf(stderr, "Newline kernel:      %s\n", newline_kernel_name);
+    fprintf(stderr, "I/O mode:            %s\n", io_names[io_mode]);
+    if (use_pipeline)
+        fprintf(stderr, "Threads:             %d walking, %d counting\n", walker_count,
+                worker_count - walker_count);
+    else
+        fprintf(stderr, "Threads:             %d\n", worker_count);
+    fprintf(stderr, "Directories:         %lu\n", st->dirs);
+    fprintf(stderr, "Entries:             %lu (%.1f per directory)\n",
+            st->entries, (double)st->entries / dirs);
+#ifdef LINEBOLT_HAVE_GETDENTS
+    fprintf(stderr, "getdents64 calls:    %lu (%.1f entries per call)\n",
+            st->dir_batches, (double)st->entries / batches);
+#else
+    fprintf(stderr, "readdir calls:       %lu\n", st->dir_batches);
+    (void)batches;
+#endif
+    fprintf(stderr, "fstatat calls:       %lu\n", st->stat_calls);
+    fprintf(stderr, "Files counted:       %lu\n", st->files);
+    if (cache_path)
+        fprintf(stderr, "Cache hits:          %lu (%lu files read)\n",
+                st->cache_hits, st->files - st->cache_hits);
+    if (use_ignore_files)
+        fprintf(stderr, "Ignored by rules:    %lu\n", st->ignored);
+    if (!follow_links && st->links_skipped)
+        fprintf(stderr, "Symlinks skipped:    %lu\n", st->links_skipped);
+    if (follow_links || unique_inodes)
+        fprintf(stderr, "Seen inodes skipped: %lu\n", st->repeats);
+    if (st->index_entries)
+        fprintf(stderr, "Index entries:       %lu\n", st->index_entries);
+    if (st->objects)
+        fprintf(stderr, "Git objects read:    %lu (%lu distinct blobs counted)\n",
+                st->objects, st->blobs);
+
+    fprintf(stderr, "Entries per directory:\n");
+    for (int b = 0; b < DIR_HISTOGRAM_BUCKETS; b++) {
+        if (!st->dir_histogram[b]) continue;
+        unsigned long lo = b == 0 ? 0 : 1UL << (b - 1);
+        unsigned long hi = b == 0 ? 0 : (1UL << b) - 1;
+        if (b == DIR_HISTOGRAM_BUCKETS - 1)
+            fprintf(stderr, "  %8lu+        %lu\n", lo, st->dir_histogram[b]);
+        else
+            fprintf(stderr, "  %8lu-%-8lu %lu\n", lo, hi, st->dir_histogram[b]);
+    }
+
+    fprintf(stderr, "Largest directories:\n");
+    for (int k = 0; k < STATS_TOP_DIRS && st->largest[k].path; k++)
+        fprintf(stderr, "  %8lu entries %6lu calls  %s\n",
+                st->largest[k].entries, st->largest[k].batches, st->largest[k].path);
+}
+
+
+// Adds 'count' per-extension totals from 'from' into 'into'
+void merge_ext_totals(ExtTotals *into, const ExtTotals *from, int count) {
+    for (int e = 0; e < count; e++) {
+        into[e].files += from[e].files;
+        into[e].lines += from[e].lines;
+        into[e].bytes += from[e].bytes;
+        into[e].kinds.code += from[e].kinds.code;
+        into[e].kinds.comment += from[e].kinds.comment;
+        into[e].kinds.blank += from[e].kinds.blank;
+    }
+}
+
+
+// Orders breakdown rows by lines, then files, largest first
+static const ExtTotals *breakdown_rows;
+int compare_breakdown_rows(const void *a, const void *b) {
+    const ExtTotals *x = &breakdown_rows[*(const int *)a], *y = &breakdown_rows[*(const int *)b];
+    if (x->lines != y->lines) return x->lines < y->lines ? 1 : -1;
+    if (x->files != y->files) return x->files < y->files ? 1 : -1;
+    return *(const int *)a - *(const int *)b;
+}
+
+
+// Prints the --by-ext or --by-lang table from the merged per-extension
+// totals. Languages are folded together here, once per run, so counting a
+// file never looks anything up.
+void print_breakdown(void) {
+    int count = ext_matcher.count;
+    ExtTotals *rows = calloc((size_t)count, sizeof(*rows));
+    const char **labels = calloc((size_t)count, sizeof(*labels));
+    char (*ext_labels)[64] = calloc((size_t)count, sizeof(*ext_labels));
+    int *order = malloc((size_t)count * sizeof(*order));
+    if (!rows || !labels || !ext_labels || !order) {
+        perror("malloc");
+        exit(1);
+    }
+
+    // Each extension folds into the first extension of its group
+    int row_count = 0;
+    for (int e = 0; e < count; e++) {
+        int into = e;
+        if (breakdown == BREAKDOWN_LANG) {
+            for (int k = 0; k < e; k++) {
+                if (ext_language[k] == ext_language[e]) {
+                    into = k;
+                    break;
+                }
+            }
+            labels[e] = language_name(e);
+        } else {
+            snprintf(ext_labels[e], sizeof(ext_labels[e]), ".%s", ext_matcher.names[e]);
+            labels[e] = ext_labels[e];
+        }
+        merge_ext_totals(&rows[into], &run_by_ext[e], 1);
+        if (into == e) order[row_count++] = e;
+    }
+
+    int width = breakdown == BREAKDOWN_LANG ? 8 : 9;  // "Language", "Extension"
+    int shown = 0;
+    for (int i = 0; i < row_count; i++) {
+        int len = (int)strlen(labels[order[i]]);
+        if (rows[order[i]].files > 0 && len > width) width = len;
+    }
+    breakdown_rows = rows;
+    qsort(order, (size_t)row_count, sizeof(*order), compare_breakdown_rows);
+
+    printf("\n%-*s %8s %12s %14s", width, breakdown == BREAKDOWN_LANG ? "Language" : "Extension",
+           "Files", "Lines", "Bytes");
+    if (classify_lines) printf(" %12s %12s %12s", "Code", "Comment", "Blank");
+    printf("\n");
+    for (int i = 0; i < row_count; i++) {
+        const ExtTotals *t = &rows[order[i]];
+        if (t->files == 0) continue;  // Only what was actually found
+        printf("%-*s %8ld %12ld %14ld", width, labels[order[i]], t->files, t->lines, t->bytes);
+        if (classify_lines) printf(" %12ld %12ld %12ld", t->kinds.code, t->kinds.comment, t->kinds.blank);
+        printf("\n");
+        shown++;
+    }
+    if (shown == 0) printf("(no files)\n");
+
+    free(rows);
+    free(labels);
+    free(ext_labels);
+    free(order);
+}
+
+
+// Lifts the soft open-file limit to the hard limit: every directory with
+// children still queued keeps its descriptor open
+void raise_fd_limit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+
+// Allocates and initializes the -j workers
+int create_workers(void) {
+    worker_count = thread_count > 0 ? thread_count : usable_cpu_count();
+    walker_count = worker_count;
+    if (use_pipeline) {
+        worker_count = walker_threads + counter_threads;
+        walker_count = walker_threads;
+    }
+    split_helpers = worker_count - (use_pipeline ? walker_count : 0) > 1;
+    workers = calloc((size_t)worker_count, sizeof(*workers));
+    if (!workers) {
+        perror("calloc");
+        return -1;
+    }
+
+    for (int i = 0; i < worker_count; i++) {
+        if (init_worker(&workers[i], i) != 0) {
+            perror("malloc");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+// Helper number 'k' (from 0) in the order run_workers() starts them: in
+// the pipeline the counters come first, then the walkers after worker 0
+static inline int helper_index(int k) {
+    int first = use_pipeline ? walker_count : 1;
+    return first + k < worker_count ? first + k : first + k - worker_count + 1;
+}
+
+
+// Runs 'thread_main' on every worker, the first one on the calling thread,
+// and waits for all of them
+// Returns 0, or -1 if the pipeline could not start a single counter
+int run_workers(void *(*thread_main)(void *)) {
+    // Start the helpers; if the system refuses more threads, carry on with
+    // the ones we have
+    int started = 0;
+    for (int k = 0; k < worker_count - 1; k++) {
+        int i = helper_index(k);
+        if (pthread_create(&workers[i].thread, NULL, thread_main, &workers[i]) != 0) {
+            fprintf(stderr, "linebolt: could only start %d threads\n", started + 1);
+            break;
+        }
+        started++;
+    }
+    if (use_pipeline) {
+        // Walkers without a counter would wait on a full queue forever
+        int counters = worker_count - walker_count;
+        if (started == 0) return -1;
+        // Walkers that never ran must not keep the counters waiting
+        int walkers_started = 1 + (started > counters ? started - counters : 0);
+        __atomic_sub_fetch(&walkers_running, walker_count - walkers_started, __ATOMIC_RELEASE);
+    }
+    thread_main(&workers[0]);
+    for (int k = 0; k < started; k++)
+        pthread_join(workers[helper_index(k)].thread, NULL);
+    return 0;
+}
+
+
+// Reduces the per-worker totals and writes the --cache file back; only
+// now can the node arenas go, since any worker may have scanned nodes
+// allocated by any other
+void finish_workers(long *total_lines) {
+    if (breakdown != BREAKDOWN_NONE) {
+        run_by_ext = calloc((size_t)ext_matcher.count, sizeof(*run_by_ext));
+        if (!run_by_ext) {
+            perror("calloc");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < worker_count; i++) {
+        *total_lines += workers[i].total_lines;
+        run_kinds.code += workers[i].kinds.code;
+        run_kinds.comment += workers[i].kinds.comment;
+        run_kinds.blank += workers[i].kinds.blank;
+        run_unique_lines += workers[i].unique_lines;
+        run_duplicate_files += workers[i].duplicate_files;
+        if (workers[i].by_ext) merge_ext_totals(run_by_ext, workers[i].by_ext, ext_matcher.count);
+        merge_stats(&run_stats, &workers[i].stats);
+        free_arena(&workers[i]);
+        free(workers[i].ignore_scratch);
+        free(workers[i].by_ext);
+    }
+
+    if (cache_path) cache_save(cache_path, workers, worker_count);
+}
+
+
+// Thread entry of the --walkers/--counters pipeline: the first workers
+// walk, the rest count
+void *pipeline_main(void *arg) {
+    Worker *w = arg;
+    if (w->id >= walker_count) return counter_main(w);
+    worker_main(w);
+    __atomic_sub_fetch(&walkers_running, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+
+// Performs a parallel depth-first traversal starting at each of the
+// 'path_count' paths: directories are walked, files are counted directly
+// Counts the total number of lines in all `.c` and `.h` files encountered
+// Accumulates the result in the variable pointed to by 'total_lines'
+// The calling thread works as worker 0 alongside 'thread_count - 1' others
+// Returns 0 on success, 1 if some starting path could not be counted (the
+// others still were, and errors are already reported), -1 on failure
+int walk_directory(const char *const *paths, int path_count, long *total_lines) {
+    raise_fd_limit();
+    if (cache_path) cache_load(cache_path);
+
+    // With either of --walkers and --counters, walking and counting run on
+    // separate threads; -j (or the CPU count) sizes whichever is not given
+    if (walker_threads > 0 || counter_threads > 0) {
+        int threads = thread_count > 0 ? thread_count : usable_cpu_count();
+        if (walker_threads == 0) walker_threads = threads / 4 > 0 ? threads / 4 : 1;
+        if (counter_threads == 0) counter_threads = threads;
+        use_pipeline = 1;
+        walkers_running = walker_threads;
+        file_queue_init();
+    }
+    if (create_workers() != 0) return -1;
+    if (follow_links && unique_inodes) pair_set_init(&visited_dirs);
+    if (unique_inodes) pair_set_init(&visited_files);
+
+    // Seed the first worker with the starting directories, along with the
+    // ignore rules of the repository around each; files are set aside
+    operand_files = malloc((size_t)path_count * sizeof(*operand_files));
+    if (!operand_files) {
+        perror("malloc");
+        return -1;
+    }
+    for (int i = 0; i < path_count; i++) {
+        const char *path = paths[i];
+        struct stat st;
+        if (stat(path, &st) == -1) {
+            perror(path);
+            operand_failed = 1;
+            continue;
+        }
+        if (S_ISREG(st.st_mode)) {
+            const char *slash = strrchr(path, '/');
+            int ext = match_extension(slash ? slash + 1 : path);
+            if (ext < 0) {
+                fprintf(stderr, "linebolt: %s: extension not counted (see --ext)\n", path);
+                operand_failed = 1;
+                continue;
+            }
+            if (unique_inodes && !pair_set_add(&visited_files, st.st_dev, st.st_ino)) continue;
+            FileOperand *f = &operand_files[operand_file_count++];
+            f->path = path;
+            f->ext = ext;
+            if (cache_path) cache_key_from_stat(&f->key, &st);
+            __atomic_add_fetch(&pending_dirs, 1, __ATOMIC_RELAXED);
+        } else if (S_ISDIR(st.st_mode)) {
+            IgnoreRules *rules = NULL;
+            int32_t *states = NULL;
+            if (use_ignore_files) rules = ignore_rules_above(path, &states);
+            push_directory(&workers[0], NULL, path, GLOB_START, rules, states);
+            ignore_rules_release(rules);
+            free(states);
+        } else {
+            fprintf(stderr, "linebolt: %s: not a file or directory\n", path);
+            operand_failed = 1;
+        }
+    }
+
+    if (run_workers(use_pipeline ? pipeline_main : worker_main) != 0) {
+        fprintf(stderr, "linebolt: cannot start a counter thread\n");
+        free(operand_files);
+        return -1;
+    }
+    finish_workers(total_lines);
+    free(operand_files);
+    return operand_failed ? 1 : 0;
+}
+
+
+// ---------------------------------------------------------------------------
+// Git index enumeration (--git-index)
+//
+// Inside a git checkout, the list of tracked files is already on disk in
+// .git/index: a header, then one entry per path in sorted order, each
+// carrying the cached stat data, the blob hash, flags and the path itself.
+// Mapping that file and walking it sequentially replaces every opendir(),
+// getdents64() and fstatat() of the directory walk; the workers then only
+// open the files that pass the extension and exclude filters.
+//
+// Entry layout (all integers big-endian), versions 2 to 4:
+//   ctime, mtime (8 bytes each), dev, ino, mode, uid, gid, size (4 each),
+//   object hash (20 bytes, 32 in SHA-256 repositories), flags (2 bytes),
+//   extended flags (2 bytes, version 3+ and only if flags & 0x4000), path.
+// Versions 2 and 3 NUL-pad every entry to a multiple of 8 bytes. Version 4
+// drops the padding and prefix-compresses the path: a varint number of
+// bytes to strip from the end of the previous path, then the NUL-terminated
+// remainder.
+// ---------------------------------------------------------------------------
+
+// Entries claimed by a worker at a time
+#define INDEX_BATCH 64
+
+#define INDEX_FLAG_EXTENDED 0x4000       // In flags: extended flags follow
+#define INDEX_XFLAG_SKIP_WORKTREE 0x4000 // In extended flags: not checked out
+
+static int use_git_index = 0;  // --git-index
+
+// Files listed by --git-index or --rev that passed the filters, as display
+// paths ("./src/a.c") relative to the starting directory, back to back
+static char *listed_names;
+static size_t listed_names_len, listed_names_cap;
+static size_t *listed_paths;   // Offset of every path in 'listed_names'
+static int *listed_exts;       // --ext extension of every path
+static size_t listed_count, listed_paths_cap;
+static long *listed_lines;     // With --dirs: lines of every file (-1 if
+static long *listed_bytes;     // it could not be counted) and bytes
+static uint32_t *listed_sizes; // --git-index: file sizes recorded in the index
+static size_t *listed_order;   // --git-index: files in the order to count them
+static size_t listed_cursor;   // Next file no worker has claimed yet
+
+static inline uint32_t get_be32(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline uint16_t get_be16(const unsigned char *p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+
+// Locates the git directory of the checkout whose top is 'top' and writes
+// the path of 'file' inside it to 'out'. A .git file ("gitdir: <path>",
+// as in worktrees and submodules) is followed.
+int git_dir_path(const char *top, const char *file, char *out, size_t out_size) {
+    char dot_git[PATH_MAX + 8];
+    snprintf(dot_git, sizeof(dot_git), "%s/.git", top);
+
+    struct stat st;
+    if (stat(dot_git, &st) == -1) return -1;
+    if (S_ISDIR(st.st_mode)) {
+        snprintf(out, out_size, "%s/%s", dot_git, file);
+        return 0;
+    }
+
+    FILE *f = fopen(dot_git, "r");
+    if (!f) return -1;
+    char line[PATH_MAX + 16];
+    int found = fgets(line, sizeof(line), f) != NULL && strncmp(line, "gitdir: ", 8) == 0;
+    fclose(f);
+    if (!found) return -1;
+    line[strcspn(line, "\r\n")] = '\0';
+
+    const char *dir = line + 8;
+    if (dir[0] == '/')
+        snprintf(out, out_size, "%s/%s", dir, file);
+    else
+        snprintf(out, out_size, "%s/%s/%s", top, dir, file);
+    return 0;
+}
+
+
+// Tells SHA-256 repositories apart, whose index entries hold longer hashes
+int git_hash_size(const char *top) {
+    char config[PATH_MAX + 16];
+    if (git_dir_path(top, "config", config, sizeof(config)) != 0) return 20;
+    FILE *f = fopen(config, "r");
+    if (!f) return 20;
+
+    int size = 20;
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        char *key = line + strspn(line, " \t");
+        if (strncasecmp(key, "objectformat", 12) == 0 && strstr(key, "sha256"))
+            size = 32;
+    }
+    fclose(f);
+    return size;
+}
+
+
+// Returns 1 if a directory on 'path' (relative to the start) is excluded;
+// consecutive entries usually share their directory, so the verdict for
+// the last directory seen is reused
+int index_path_excluded(const char *path, size_t path_len) {
+    static char last_dir[PATH_MAX];
+    static size_t last_dir_len = (size_t)-1;
+    static int last_excluded;
+
+    const char *slash = memrchr(path, '/', path_len);
+    size_t dir_len = slash ? (size_t)(slash - path) : 0;
+    if (dir_len == last_dir_len && memcmp(path, last_dir, dir_len) == 0)
+        return last_excluded;
+
+    int excluded = 0;
+    int32_t state = GLOB_START;
+    for (size_t i = 0; i < dir_len && state != GLOB_DEAD; i++) {
+        if (path[i] == '/' && exclude_dfa.accept[state] >= 0) {
+            excluded = 1;
+            break;
+        }
+        state = glob_step(&exclude_dfa, state, (unsigned char)path[i]);
+    }
+    if (!excluded && dir_len > 0 && exclude_dfa.accept[state] >= 0) excluded = 1;
+
+    if (dir_len < sizeof(last_dir)) {
+        memcpy(last_dir, path, dir_len);
+        last_dir_len = dir_len;
+        last_excluded = excluded;
+    }
+    return excluded;
+}
+
+
+// Appends "./" + path[0..len), a file with --ext extension 'ext', to the
+// listed files
+void list_file(const char *path, size_t len, int ext) {
+    size_t needed = listed_names_len + len + 3;
+    if (needed > listed_names_cap) {
+        listed_names_cap = needed > 2 * listed_names_cap ? needed : 2 * listed_names_cap;
+        listed_names = realloc(listed_names, listed_names_cap);
+    }
+    if (listed_count == listed_paths_cap) {
+        listed_paths_cap = listed_paths_cap ? 2 * listed_paths_cap : 1024;
+        listed_paths = realloc(listed_paths, listed_paths_cap * sizeof(*listed_paths));
+        listed_exts = realloc(listed_exts, listed_paths_cap * sizeof(*listed_exts));
+    }
+    if (!listed_names || !listed_paths || !listed_exts) {
+        perror("realloc");
+        exit(1);
+    }
+
+    char *dst = listed_names + listed_names_len;
+    listed_exts[listed_count] = ext;
+    listed_paths[listed_count++] = listed_names_len;
+    dst[0] = '.';
+    dst[1] = '/';
+    memcpy(dst + 2, path, len);
+    dst[len + 2] = '\0';
+    listed_names_len = needed;
+}
+
+
+// Adds a tracked file to the list if it passes the filters; 'path' is
+// relative to the repository top and must start with 'prefix' (the
+// starting directory, ending in '/', or empty at the top)
+void index_consider(const char *path, size_t len, const char *prefix, size_t prefix_len,
+                    uint32_t file_size) {
+    if (len <= prefix_len || memcmp(path, prefix, prefix_len) != 0) return;
+    path += prefix_len;
+    len -= prefix_len;
+
+    const char *slash = memrchr(path, '/', len);
+    int ext = match_extension(slash ? slash + 1 : path);
+    if (ext < 0) return;
+    if (index_path_excluded(path, len)) return;
+    list_file(path, len, ext);
+
+    static size_t sizes_cap;
+    if (listed_count > sizes_cap) {
+        sizes_cap = sizes_cap ? 2 * sizes_cap : 1024;
+        listed_sizes = realloc(listed_sizes, sizes_cap * sizeof(*listed_sizes));
+        if (!listed_sizes) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    listed_sizes[listed_count - 1] = file_size;
+}
+
+
+// Orders the listed files largest first, so no big file is left to start
+// last while the other threads run dry (longest processing time first).
+// Sizes are bucketed by their bit length, which is all the precision the
+// schedule needs, and files keep their path order within a bucket.
+void order_listed_by_size(void) {
+    // Bucket b holds the sizes with b leading zero bits (32 for empty files)
+    size_t starts[34] = {0};
+    for (size_t i = 0; i < listed_count; i++)
+        starts[(listed_sizes[i] ? __builtin_clz(listed_sizes[i]) : 32) + 1]++;
+    for (int b = 1; b < 34; b++) starts[b] += starts[b - 1];
+
+    listed_order = malloc((listed_count + 1) * sizeof(*listed_order));
+    if (!listed_order) {
+        perror("malloc");
+        exit(1);
+    }
+    for (size_t i = 0; i < listed_count; i++)
+        listed_order[starts[listed_sizes[i] ? __builtin_clz(listed_sizes[i]) : 32]++] = i;
+}
+
+
+// Walks the entries of a mapped index file, handing every checked-out
+// regular file at stage 0 to index_consider()
+// Returns 0 on success, -1 (after a diagnostic) if the file is not usable
+int index_parse(const unsigned char *data, size_t size, int hash_size,
+                const char *prefix, size_t prefix_len) {
+    if (size < 12 + (size_t)hash_size || memcmp(data, "DIRC", 4) != 0) {
+        fprintf(stderr, "linebolt: not a git index file\n");
+        return -1;
+    }
+    uint32_t version = get_be32(data + 4);
+    if (version < 2 || version > 4) {
+        fprintf(stderr, "linebolt: unsupported git index version %u\n", version);
+        return -1;
+    }
+    size_t entries = get_be32(data + 8);
+    run_stats.index_entries = entries;
+
+    const unsigned char *p = data + 12;
+    const unsigned char *end = data + size - hash_size;  // Trailing checksum
+    size_t fixed = 40 + (size_t)hash_size + 2;           // Bytes before the path
+    PathBuf name = {0};                                  // Previous path, for version 4
+
+    for (size_t i = 0; i < entries; i++) {
+        if ((size_t)(end - p) < fixed) goto truncated;
+        const unsigned char *entry = p;
+        uint32_t mode = get_be32(p + 24);
+        uint16_t flags = get_be16(p + 40 + hash_size);
+        uint16_t xflags = 0;
+        size_t header = fixed;
+        if (flags & INDEX_FLAG_EXTENDED) {
+            if (version < 3 || (size_t)(end - p) < fixed + 2) goto truncated;
+            xflags = get_be16(p + fixed);
+            header += 2;
+        }
+
+        const unsigned char *q = p + header;
+        size_t len;
+        const char *path;
+        if (version == 4) {
+            // Varint as in git's decode_varint(): each continuation adds one
+            size_t strip = 0;
+            unsigned char c;
+            do {
+                if (q == end) goto truncated;
+                c = *q++;
+                strip = (strip << 7) | (c & 127);
+                if (c & 128) strip++;
+            } while (c & 128);
+            const unsigned char *nul = memchr(q, '\0', (size_t)(end - q));
+            if (!nul || strip > name.len) goto truncated;
+            size_t suffix = (size_t)(nul - q);
+            name.len -= strip;
+            pathbuf_reserve(&name, name.len + suffix + 1);
+            memcpy(name.data + name.len, q, suffix);
+            name.len += suffix;
+            name.data[name.len] = '\0';
+            path = name.data;
+            len = name.len;
+            p = nul + 1;
+        } else {
+            const unsigned char *nul = memchr(q, '\0', (size_t)(end - q));
+            if (!nul) goto truncated;
+            path = (const char *)q;
+            len = (size_t)(nul - q);
+            size_t entry_size = (header + len + 8) & ~(size_t)7;
+            if ((size_t)(end - p) < entry_size) goto truncated;
+            p += entry_size;
+        }
+
+        // Only regular files that are merged (stage 0) and checked out
+        if ((mode & S_IFMT) != S_IFREG || (flags >> 12 & 3) != 0 ||
+            (xflags & INDEX_XFLAG_SKIP_WORKTREE))
+            continue;
+        index_consider(path, len, prefix, prefix_len, get_be32(entry + 36));
+    }
+    free(name.data);
+
+    // A split index keeps most entries in a second file; rather than
+    // counting half the tree, let the caller fall back to walking
+    while ((size_t)(end - p) >= 8) {
+        uint32_t ext_size = get_be32(p + 4);
+        if (memcmp(p, "link", 4) == 0) {
+            fprintf(stderr, "linebolt: split git index is not supported\n");
+            return -1;
+        }
+        if ((size_t)(end - p) - 8 < ext_size) break;
+        p += 8 + ext_size;
+    }
+    return 0;
+
+truncated:
+    free(name.data);
+    fprintf(stderr, "linebolt: git index is truncated or corrupt\n");
+    return -1;
+}
+
+
+// Counts one tracked file for the worker, going through --cache like the
+// directory walk does
+void count_index_file(Worker *w, size_t index) {
+    const char *path = listed_names + listed_paths[index];
+    int ext = listed_exts[index];
+    w->stats.files++;
+
+    CacheRecord key;
+    if (cache_path) {
+        struct stat st;
+        w->stats.stat_calls++;
+        if (stat(path, &st) == -1) {
+            perror(path);
+            return;
+        }
+        cache_key_from_stat(&key, &st);
+        long cached_lines;
+        uint64_t cached_hash;
+        if (cache_lookup(&key, &cached_lines, &cached_hash)) {
+            w->stats.cache_hits++;
+            cache_remember(w, &key, cached_lines, cached_hash);
+            report_file(w, path, ext, cached_lines, (long)key.size, NULL, cached_hash);
+            if (listed_lines) {
+                listed_lines[index] = cached_lines;
+                listed_bytes[index] = (long)key.size;
+            }
+            return;
+        }
+    }
+
+    LineScan scan;
+    scan_start(&scan, ext);
+    int rc = count_lines_in_file(AT_FDCWD, path, path, w->read_buf, &scan);
+    long file_lines = scan_finish(&scan);
+    uint64_t content_hash = rc == 0 ? scan_content_hash(&scan) : 0;
+    if (cache_path && rc == 0) cache_remember(w, &key, file_lines, content_hash);
+    LineKinds kinds = scan_kinds(&scan);
+    report_file(w, path, ext, file_lines, scan.bytes, classify_lines ? &kinds : NULL, content_hash);
+    if (listed_lines) {
+        listed_lines[index] = file_lines;
+        listed_bytes[index] = scan.bytes;
+    }
+}
+
+
+// Allocates the per-file results --dirs needs for the listed files
+void listed_rollup_init(void) {
+    listed_lines = malloc((listed_count + 1) * sizeof(*listed_lines));
+    listed_bytes = calloc(listed_count + 1, sizeof(*listed_bytes));
+    if (!listed_lines || !listed_bytes) {
+        perror("malloc");
+        exit(1);
+    }
+    for (size_t i = 0; i < listed_count; i++) listed_lines[i] = -1;
+}
+
+
+// Reports the --dirs totals of the listed files. The list is in path
+// order, so the files below any directory are contiguous, and a stack of
+// the directories along the current path is all the state needed.
+void rollup_listed(Worker *w) {
+    typedef struct {
+        const char *path;        // A listed path starting with this directory
+        size_t len;              // Length of the directory's part of 'path'
+        long lines, files, bytes;
+    } Level;
+    size_t cap = 16, depth = 0;
+    Level *stack = malloc(cap * sizeof(*stack));
+    PathBuf text = {0};
+    if (!stack) {
+        perror("malloc");
+        exit(1);
+    }
+    stack[depth++] = (Level){".", 1, 0, 0, 0};
+
+    for (size_t i = 0; i <= listed_count; i++) {
+        const char *path = i < listed_count ? listed_names + listed_paths[i] : "./";  // End marker
+        size_t dir_len = (size_t)(strrchr(path, '/') - path);
+
+        // Close the directories this path is not in; the end closes all
+        int last = i == listed_count;
+        while (depth > 0) {
+            Level *top = &stack[depth - 1];
+            if (!last && top->len <= dir_len && memcmp(top->path, path, top->len) == 0 &&
+                (top->len == dir_len || path[top->len] == '/'))
+                break;
+            if (rollup_shown((int)depth - 1, top->files)) {
+                pathbuf_reserve(&text, top->len + 1);
+                memcpy(text.data, top->path, top->len);
+                text.data[top->len] = '\0';
+                out_dir_line(&w->out, top->lines, top->files, top->bytes, text.data);
+            }
+            if (--depth > 0) {
+                stack[depth - 1].lines += top->lines;
+                stack[depth - 1].files += top->files;
+                stack[depth - 1].bytes += top->bytes;
+            }
+        }
+        if (i == listed_count) break;
+
+        // Open the ones it is in, then count the file
+        for (size_t pos = stack[depth - 1].len + 1; pos <= dir_len; pos++) {
+            if (pos < dir_len && path[pos] != '/') continue;
+            if (depth == cap) {
+                cap *= 2;
+                stack = realloc(stack, cap * sizeof(*stack));
+                if (!stack) {
+                    perror("realloc");
+                    exit(1);
+                }
+            }
+            stack[depth++] = (Level){path, pos, 0, 0, 0};
+        }
+        if (listed_lines[i] >= 0) {
+            stack[depth - 1].lines += listed_lines[i];
+            stack[depth - 1].files++;
+            stack[depth - 1].bytes += listed_bytes[i];
+        }
+    }
+    out_flush(&w->out, NULL, 0);
+    free(stack);
+    free(text.data);
+}
+
+
+// Worker loop for --git-index: claim a batch of entries, count them, repeat
+void *index_worker_main(void *arg) {
+    Worker *w = arg;
+    for (;;) {
+        size_t first = __atomic_fetch_add(&listed_cursor, INDEX_BATCH, __ATOMIC_RELAXED);
+        if (first >= listed_count) {
+            // Nothing left to claim: help with split files until they are done
+            if (help_split(w->read_buf)) continue;
+            break;
+        }
+        size_t last = first + INDEX_BATCH < listed_count ? first + INDEX_BATCH : listed_count;
+        for (size_t i = first; i < last; i++)
+            count_index_file(w, listed_order ? listed_order[i] : i);
+    }
+    out_flush(&w->out, NULL, 0);
+    return NULL;
+}
+
+
+// Counts the tracked files below 'start_path' as listed by the git index
+// Returns -1 before any counting if there is no usable index, so the
+// caller can walk the directory instead
+int count_git_index(const char *start_path, long *total_lines) {
+    size_t top_len;
+    char *real = find_repo_top(start_path, &top_len);
+    if (!real) {
+        fprintf(stderr, "linebolt: --git-index: not inside a git repository\n");
+        return -1;
+    }
+
+    // The starting directory's path inside the repository, with a '/'
+    char top[PATH_MAX], index_path[PATH_MAX + 16], prefix[PATH_MAX + 1];
+    snprintf(top, sizeof(top), "%.*s", (int)top_len, real);
+    const char *rest = real + top_len;
+    while (*rest == '/') rest++;
+    snprintf(prefix, sizeof(prefix), "%s%s", rest, *rest ? "/" : "");
+    free(real);
+
+    int fd = -1;
+    struct stat st;
+    if (git_dir_path(top, "index", index_path, sizeof(index_path)) != 0 ||
+        (fd = open(index_path, O_RDONLY | O_CLOEXEC)) == -1 || fstat(fd, &st) == -1 ||
+        st.st_size == 0) {
+        fprintf(stderr, "linebolt: --git-index: no index in %s\n", top);
+        if (fd != -1) close(fd);
+        return -1;
+    }
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror(index_path);
+        return -1;
+    }
+    madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+    int rc = index_parse(data, (size_t)st.st_size, git_hash_size(top), prefix, strlen(prefix));
+    munmap(data, (size_t)st.st_size);
+    if (rc != 0) return -1;
+
+    // The io_uring engine queues files by directory and entry name, which
+    // index paths are not; plain reads are used instead
+    if (io_mode == IO_URING) io_mode = IO_READ;
+
+    if (cache_path) cache_load(cache_path);
+    if (create_workers() != 0) return -1;
+    if (dir_rollups) listed_rollup_init();
+    if (worker_count > 1) order_listed_by_size();
+    run_workers(index_worker_main);
+    if (dir_rollups) rollup_listed(&workers[0]);
+    finish_workers(total_lines);
+    return 0;
+}
+
+
+
+// ---------------------------------------------------------------------------
+// Git object store (--rev)
+//
+// Counts the files of any commit straight from .git/objects, without a
+// checkout. The revision is resolved to a commit, its tree is walked
+// (trees are objects listing mode, name and hash of every entry) and the
+// blobs of matching files are inflated and scanned like file contents.
+//
+// Objects live either loose, as objects/xx/yyyy... holding the zlib-
+// compressed "type size\0content", or in packs: a .pack file of
+// compressed entries plus a .idx with the sorted hashes and their pack
+// offsets, binary-searched through a 256-entry fan-out table. A packed
+// entry may be a delta against another entry (by offset or by hash), so
+// reading it means inflating the chain's base and replaying the copy/insert
+// instructions of every delta on top; each thread keeps recent bases in a
+// small cache since neighbouring objects tend to share them.
+//
+// Blobs are content-addressed, so their line counts are memoized by hash:
+// a blob is inflated once per run however many paths (or revisions) use it.
+// ---------------------------------------------------------------------------
+
+#define GIT_MAX_HASH 32
+
+// Object types, as numbered in pack entry headers
+#define GIT_OBJ_COMMIT 1
+#define GIT_OBJ_TREE 2
+#define GIT_OBJ_BLOB 3
+#define GIT_OBJ_TAG 4
+#define GIT_OBJ_OFS_DELTA 6
+#define GIT_OBJ_REF_DELTA 7
+
+// Per-thread delta base cache: slots, and the largest object kept / total
+#define GIT_BASE_CACHE_SLOTS 256
+#define GIT_BASE_CACHE_MAX_OBJECT (1024 * 1024)
+#define GIT_BASE_CACHE_BUDGET (32 * 1024 * 1024)
+
+// Blobs claimed by a worker at a time
+#define BLOB_BATCH 16
+
+static const char *rev_spec = NULL;       // --rev
+static const char *history_range = NULL;  // --history
+
+#ifdef LINEBOLT_HAVE_ZLIB
+
+// One pack: its mapped index (version 2) and data
+typedef struct {
+    const unsigned char *idx;
+    size_t idx_size;
+    const unsigned char *data;
+    size_t data_size;
+    uint32_t count;              // Objects in the pack
+} GitPack;
+
+static char git_private_dir[PATH_MAX];  // Holds HEAD (a worktree's own dir)
+static char git_common_dir[PATH_MAX];   // Holds refs and objects
+static int git_hash_len = 20;
+static GitPack *git_packs;
+static int git_pack_count;
+
+// Inflated object kept for later deltas
+typedef struct {
+    const GitPack *pack;
+    uint64_t offset;
+    unsigned char *data;
+    size_t size;
+    int type;
+} GitCachedBase;
+
+// Per-thread object reader
+typedef struct GitReader {
+    z_stream z;
+    GitCachedBase cache[GIT_BASE_CACHE_SLOTS];
+    size_t cache_bytes;
+    unsigned long objects;       // Objects inflated, for --stats
+} GitReader;
+
+// Line count of one blob, shared by every path that holds it
+typedef struct {
+    unsigned char hash[GIT_MAX_HASH];
+    long lines;                  // -1 until counted, and if it cannot be read
+    long bytes;
+    LineKinds kinds;             // With --classify
+    int ext;                     // --ext extension of the first path seen with it
+} BlobCount;
+
+static BlobCount *blob_counts;
+static size_t blob_count, blob_counts_cap;
+static uint32_t *blob_table;     // Open addressing over 'blob_counts', UINT32_MAX = empty
+static size_t blob_table_cap;
+static size_t *blob_todo;        // Blobs still to be counted in this run
+static size_t blob_todo_count, blob_todo_cap, blob_cursor;
+static size_t *listed_blobs;     // Blob of every listed file
+static size_t listed_blobs_cap;
+static int git_read_failed;      // A tree or blob could not be read: exit status 1
+
+
+void git_hex(const unsigned char *hash, char *out) {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < git_hash_len; i++) {
+        out[2 * i] = digits[hash[i] >> 4];
+        out[2 * i + 1] = digits[hash[i] & 15];
+    }
+    out[2 * git_hash_len] = '\0';
+}
+
+
+int hex_digit(int c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+
+// Parses 'digits' hex digits into bytes (a trailing odd digit fills the high
+// nibble); returns -1 on a non-hex character
+int git_parse_hex(const char *hex, int digits, unsigned char *out) {
+    memset(out, 0, GIT_MAX_HASH);
+    for (int i = 0; i < digits; i++) {
+        int d = hex_digit((unsigned char)hex[i]);
+        if (d < 0) return -1;
+        out[i / 2] |= (unsigned char)(i % 2 ? d : d << 4);
+    }
+    return 0;
+}
+
+
+// Maps one .idx file and the .pack next to it
+void git_load_pack(const char *idx_path) {
+    size_t idx_size, data_size;
+    void *idx = NULL, *data = NULL;
+    char pack_path[PATH_MAX];
+    size_t len = strlen(idx_path);
+    snprintf(pack_path, sizeof(pack_path), "%.*s.pack", (int)(len - 4), idx_path);
+
+    int fd = open(idx_path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) goto fail;
+    idx_size = (size_t)st.st_size;
+    idx = mmap(NULL, idx_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    fd = -1;
+    if (idx == MAP_FAILED) goto fail;
+
+    // Magic "\377tOc", version 2, fan-out, then hashes, CRCs and offsets
+    const unsigned char *p = idx;
+    if (idx_size < 8 + 1024 || memcmp(p, "\377tOc", 4) != 0 || get_be32(p + 4) != 2) goto fail;
+    uint32_t count = get_be32(p + 8 + 255 * 4);
+    if (idx_size < 8 + 1024 + (size_t)count * (git_hash_len + 8) + 2 * git_hash_len) goto fail;
+
+    fd = open(pack_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 || fstat(fd, &st) == -1) goto fail;
+    data_size = (size_t)st.st_size;
+    data = mmap(NULL, data_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    fd = -1;
+    if (data == MAP_FAILED || data_size < 12 || memcmp(data, "PACK", 4) != 0) goto fail;
+
+    GitPack *packs = realloc(git_packs, (size_t)(git_pack_count + 1) * sizeof(*packs));
+    if (!packs) {
+        perror("realloc");
+        exit(1);
+    }
+    git_packs = packs;
+    git_packs[git_pack_count++] = (GitPack){idx, idx_size, data, data_size, count};
+    return;
+
+fail:
+    fprintf(stderr, "linebolt: skipping unreadable pack %s\n", idx_path);
+    if (fd != -1) close(fd);
+    if (idx && idx != MAP_FAILED) munmap(idx, idx_size);
+    if (data && data != MAP_FAILED) munmap(data, data_size);
+}
+
+
+// Locates the repository around 'start_path' and maps its packs
+// Returns the repository top's length within the real path in '*real'
+int git_open_repo(const char *start_path, char **real, size_t *top_len) {
+    *real = find_repo_top(start_path, top_len);
+    if (!*real) {
+        fprintf(stderr, "linebolt: --rev: not inside a git repository\n");
+        return -1;
+    }
+    char top[PATH_MAX];
+    snprintf(top, sizeof(top), "%.*s", (int)*top_len, *real);
+    if (git_dir_path(top, "", git_private_dir, sizeof(git_private_dir)) != 0) {
+        fprintf(stderr, "linebolt: --rev: cannot find the git directory of %s\n", top);
+        return -1;
+    }
+    git_private_dir[strlen(git_private_dir) - 1] = '\0';  // Drop the trailing '/'
+    git_hash_len = git_hash_size(top);
+
+    // Linked worktrees keep refs and objects in the main repository
+    snprintf(git_common_dir, sizeof(git_common_dir), "%s", git_private_dir);
+    char path[2 * PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s/commondir", git_private_dir);
+    FILE *f = fopen(path, "r");
+    if (f) {
+        char line[PATH_MAX];
+        if (fgets(line, sizeof(line), f)) {
+            line[strcspn(line, "\r\n")] = '\0';
+            int len = line[0] == '/' ? snprintf(path, sizeof(path), "%s", line)
+                                     : snprintf(path, sizeof(path), "%s/%s", git_private_dir, line);
+            if (len < (int)sizeof(git_common_dir)) memcpy(git_common_dir, path, (size_t)len + 1);
+        }
+        fclose(f);
+    }
+
+    snprintf(path, sizeof(path), "%s/objects/pack", git_common_dir);
+    DIR *dir = opendir(path);
+    if (dir) {
+        struct dirent *entry;
+        while ((entry = readdir(dir))) {
+            size_t len = strlen(entry->d_name);
+            if (len > 4 && strcmp(entry->d_name + len - 4, ".idx") == 0) {
+                char idx_path[sizeof(path) + sizeof(entry->d_name) + 1];
+                snprintf(idx_path, sizeof(idx_path), "%s/%s", path, entry->d_name);
+                git_load_pack(idx_path);
+            }
+        }
+        closedir(dir);
+    }
+    return 0;
+}
+
+
+// Offset of the i-th object of a pack (in hash order)
+uint64_t git_pack_offset(const GitPack *pack, uint32_t i) {
+    const unsigned char *offsets = pack->idx + 8 + 1024 + (size_t)pack->count * (git_hash_len + 4);
+    uint32_t small = get_be32(offsets + 4 * (size_t)i);
+    if (!(small & 0x80000000u)) return small;
+
+    // Large packs: the high bit points into a table of 64-bit offsets
+    const unsigned char *large = offsets + 4 * (size_t)pack->count + 8 * (size_t)(small & 0x7fffffffu);
+    if (large + 8 > pack->idx + pack->idx_size - 2 * git_hash_len) return UINT64_MAX;
+    return (uint64_t)get_be32(large) << 32 | get_be32(large + 4);
+}
+
+
+// First object of a pack whose hash is not below 'hash' (binary search
+// within the fan-out bucket of its first byte)
+uint32_t git_pack_lower_bound(const GitPack *pack, const unsigned char *hash) {
+    const unsigned char *fanout = pack->idx + 8;
+    const unsigned char *hashes = fanout + 1024;
+    uint32_t lo = hash[0] ? get_be32(fanout + 4 * (hash[0] - 1)) : 0;
+    uint32_t hi = get_be32(fanout + 4 * hash[0]);
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (memcmp(hashes + (size_t)mid * git_hash_len, hash, (size_t)git_hash_len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+
+// Finds a packed object; returns 0 and its pack and offset if present
+int git_find_packed(const unsigned char *hash, const GitPack **pack, uint64_t *offset) {
+    for (int k = 0; k < git_pack_count; k++) {
+        const GitPack *p = &git_packs[k];
+        uint32_t i = git_pack_lower_bound(p, hash);
+        if (i < p->count &&
+            memcmp(p->idx + 8 + 1024 + (size_t)i * git_hash_len, hash, (size_t)git_hash_len) == 0) {
+            *pack = p;
+            *offset = git_pack_offset(p, i);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+
+// Parses the header of the pack entry at 'offset': type, inflated size and,
+// for deltas, where the base is. '*payload' points at the zlib data.
+int git_pack_entry(const GitPack *pack, uint64_t offset, int *type, size_t *size,
+                   const unsigned char **payload, uint64_t *base_offset,
+                   const unsigned char **base_hash) {
+    if (offset >= pack->data_size) return -1;
+    const unsigned char *p = pack->data + offset, *end = pack->data + pack->data_size;
+
+    unsigned c = *p++;
+    *type = (c >> 4) & 7;
+    size_t value = c & 15;
+    int shift = 4;
+    while (c & 128) {
+        if (p == end || shift > 57) return -1;
+        c = *p++;
+        value |= (size_t)(c & 127) << shift;
+        shift += 7;
+    }
+    *size = value;
+
+    if (*type == GIT_OBJ_OFS_DELTA) {
+        // Distance back to the base, in git's offset varint
+        if (p == end) return -1;
+        c = *p++;
+        uint64_t distance = c & 127;
+        while (c & 128) {
+            if (p == end || distance > (UINT64_MAX >> 8)) return -1;
+            c = *p++;
+            distance = ((distance + 1) << 7) | (c & 127);
+        }
+        if (distance == 0 || distance > offset) return -1;
+        *base_offset = offset - distance;
+    } else if (*type == GIT_OBJ_REF_DELTA) {
+        if ((size_t)(end - p) < (size_t)git_hash_len) return -1;
+        *base_hash = p;
+        p += git_hash_len;
+    } else if (*type < GIT_OBJ_COMMIT || *type > GIT_OBJ_TAG) {
+        return -1;
+    }
+    *payload = p;
+    return 0;
+}
+
+
+// Inflates the zlib stream at 'src' into a new buffer of exactly 'size'
+// bytes (plus a terminating NUL, handy for commits and tags)
+unsigned char *git_inflate(GitReader *r, const unsigned char *src, size_t src_len, size_t size) {
+    unsigned char *out = malloc(size + 1);
+    if (!out) {
+        perror("malloc");
+        exit(1);
+    }
+    z_stream *z = &r->z;
+    inflateReset(z);
+    z->next_in = (unsigned char *)src;
+    z->avail_in = src_len > UINT_MAX ? UINT_MAX : (unsigned)src_len;
+    z->next_out = out;
+    z->avail_out = size + 1 > UINT_MAX ? UINT_MAX : (unsigned)(size + 1);
+
+    // One spare byte of output space catches streams longer than promised
+    int rc;
+    do {
+        rc = inflate(z, Z_FINISH);
+    } while (rc == Z_BUF_ERROR && z->avail_out > 0 && z->avail_in > 0);
+    if (rc != Z_STREAM_END || z->total_out != size) {
+        free(out);
+        return NULL;
+    }
+    r->objects++;
+    out[size] = '\0';
+    return out;
+}
+
+
+// Reads one size varint of a delta header
+size_t git_delta_size(const unsigned char **p, const unsigned char *end) {
+    size_t value = 0;
+    int shift = 0;
+    unsigned c;
+    do {
+        if (*p == end || shift > 57) return SIZE_MAX;
+        c = *(*p)++;
+        value |= (size_t)(c & 127) << shift;
+        shift += 7;
+    } while (c & 128);
+    return value;
+}
+
+
+// Rebuilds an object from its delta base: after the base and result sizes,
+// every instruction either copies a range of the base or inserts new bytes
+unsigned char *git_apply_delta(const unsigned char *base, size_t base_size,
+                               const unsigned char *delta, size_t delta_size, size_t *out_size) {
+    const unsigned char *d = delta, *end = delta + delta_size;
+    size_t source_size = git_delta_size(&d, end);
+    size_t target_size = git_delta_size(&d, end);
+    if (source_size != base_size || target_size == SIZE_MAX) return NULL;
+
+    unsigned char *out = malloc(target_size + 1);
+    if (!out) {
+        perror("malloc");
+        exit(1);
+    }
+    unsigned char *o = out, *o_end = out + target_size;
+    while (d < end) {
+        unsigned op = *d++;
+        if (op & 0x80) {
+            // Copy: up to 4 offset bytes and 3 size bytes, as flagged
+            size_t off = 0, len = 0;
+            for (int i = 0; i < 4; i++) {
+                if (!(op & (1u << i))) continue;
+                if (d == end) goto bad;
+                off |= (size_t)*d++ << (8 * i);
+            }
+            for (int i = 0; i < 3; i++) {
+                if (!(op & (0x10u << i))) continue;
+                if (d == end) goto bad;
+                len |= (size_t)*d++ << (8 * i);
+            }
+            if (len == 0) len = 0x10000;
+            if (off > base_size || len > base_size - off || len > (size_t)(o_end - o)) goto bad;
+            memcpy(o, base + off, len);
+            o += len;
+        } else if (op) {
+            // Insert the next 'op' bytes of the delta
+            if (op > (size_t)(end - d) || op > (size_t)(o_end - o)) goto bad;
+            memcpy(o, d, op);
+            o += op;
+            d += op;
+        } else {
+            goto bad;
+        }
+    }
+    if (o != o_end) goto bad;
+    out[target_size] = '\0';
+    *out_size = target_size;
+    return out;
+
+bad:
+    free(out);
+    return NULL;
+}
+
+
+GitCachedBase *git_cache_slot(GitReader *r, const GitPack *pack, uint64_t offset) {
+    uint64_t key = (offset ^ ((uintptr_t)pack >> 4)) * 0x9E3779B97F4A7C15ULL;
+    return &r->cache[key >> 56 & (GIT_BASE_CACHE_SLOTS - 1)];
+}
+
+
+// Keeps a copy of an inflated pack entry for later deltas, within budget
+void git_cache_store(GitReader *r, const GitPack *pack, uint64_t offset,
+                     const unsigned char *data, size_t size, int type) {
+    if (size > GIT_BASE_CACHE_MAX_OBJECT) return;
+    GitCachedBase *slot = git_cache_slot(r, pack, offset);
+    r->cache_bytes -= slot->data ? slot->size : 0;
+    free(slot->data);
+    slot->data = NULL;
+    if (r->cache_bytes + size > GIT_BASE_CACHE_BUDGET) return;
+
+    slot->data = malloc(size + 1);
+    if (!slot->data) return;
+    memcpy(slot->data, data, size + 1);
+    slot->pack = pack;
+    slot->offset = offset;
+    slot->size = size;
+    slot->type = type;
+    r->cache_bytes += size;
+}
+
+
+unsigned char *git_read_object(GitReader *r, const unsigned char *hash, int *type, size_t *size);
+
+// Reads the pack entry at 'offset', resolving delta chains: the chain is
+// followed down to a stored (or cached) base, then the deltas are applied
+// back up in order
+unsigned char *git_read_packed(GitReader *r, const GitPack *pack, uint64_t offset,
+                               int *type, size_t *size) {
+    uint64_t *chain = NULL;
+    size_t depth = 0, cap = 0;
+    unsigned char *data = NULL;
+    size_t data_size = 0;
+    int data_type = 0;
+
+    for (;;) {
+        GitCachedBase *cached = git_cache_slot(r, pack, offset);
+        if (cached->data && cached->pack == pack && cached->offset == offset) {
+            data = malloc(cached->size + 1);
+            if (!data) {
+                perror("malloc");
+                exit(1);
+            }
+            memcpy(data, cached->data, cached->size + 1);
+            data_size = cached->size;
+            data_type = cached->type;
+            break;
+        }
+
+        int t;
+        size_t sz;
+        const unsigned char *payload, *base_hash = NULL;
+        uint64_t base_offset = 0;
+        if (git_pack_entry(pack, offset, &t, &sz, &payload, &base_offset, &base_hash) != 0) break;
+        if (t == GIT_OBJ_OFS_DELTA || t == GIT_OBJ_REF_DELTA) {
+            if (depth == cap) {
+                cap = cap ? 2 * cap : 16;
+                chain = realloc(chain, cap * sizeof(*chain));
+                if (!chain) {
+                    perror("realloc");
+                    exit(1);
+                }
+            }
+            chain[depth++] = offset;
+            if (t == GIT_OBJ_OFS_DELTA) {
+                offset = base_offset;
+                continue;
+            }
+            data = git_read_object(r, base_hash, &data_type, &data_size);
+            break;
+        }
+        data = git_inflate(r, payload, pack->data_size - (size_t)(payload - pack->data), sz);
+        data_size = sz;
+        data_type = t;
+        if (data && depth > 0) git_cache_store(r, pack, offset, data, data_size, data_type);
+        break;
+    }
+
+    while (data && depth > 0) {
+        uint64_t at = chain[--depth];
+        int t;
+        size_t sz, out_size = 0;
+        const unsigned char *payload, *base_hash;
+        uint64_t base_offset;
+        unsigned char *delta = NULL, *out = NULL;
+        if (git_pack_entry(pack, at, &t, &sz, &payload, &base_offset, &base_hash) == 0)
+            delta = git_inflate(r, payload, pack->data_size - (size_t)(payload - pack->data), sz);
+        if (delta) out = git_apply_delta(data, data_size, delta, sz, &out_size);
+        free(delta);
+        free(data);
+        data = out;
+        data_size = out_size;
+        if (data && depth > 0) git_cache_store(r, pack, at, data, data_size, data_type);
+    }
+    free(chain);
+
+    *type = data_type;
+    *size = data_size;
+    return data;
+}
+
+
+// Reads a loose object: zlib("type size\0" + content)
+unsigned char *git_read_loose(GitReader *r, const unsigned char *hash, int *type, size_t *size) {
+    char hex[2 * GIT_MAX_HASH + 1], path[PATH_MAX + 2 * GIT_MAX_HASH + 16];
+    git_hex(hash, hex);
+    snprintf(path, sizeof(path), "%s/objects/%.2s/%s", git_common_dir, hex, hex + 2);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    void *src = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (src == MAP_FAILED) return NULL;
+
+    // Inflate just enough for the header, then the rest into place
+    unsigned char header[64];
+    z_stream *z = &r->z;
+    inflateReset(z);
+    z->next_in = src;
+    z->avail_in = (unsigned)st.st_size;
+    z->next_out = header;
+    z->avail_out = sizeof(header);
+    int rc = inflate(z, Z_NO_FLUSH);
+    unsigned char *data = NULL;
+    size_t got = sizeof(header) - z->avail_out;
+    unsigned char *nul = memchr(header, '\0', got);
+    if ((rc == Z_OK || rc == Z_STREAM_END) && nul) {
+        size_t header_len = (size_t)(nul - header) + 1;
+        if (strncmp((char *)header, "commit ", 7) == 0) *type = GIT_OBJ_COMMIT;
+        else if (strncmp((char *)header, "tree ", 5) == 0) *type = GIT_OBJ_TREE;
+        else if (strncmp((char *)header, "blob ", 5) == 0) *type = GIT_OBJ_BLOB;
+        else if (strncmp((char *)header, "tag ", 4) == 0) *type = GIT_OBJ_TAG;
+        else *type = 0;
+        const char *digits = memchr(header, ' ', header_len);
+        size_t sz = digits ? strtoull(digits + 1, NULL, 10) : 0;
+        size_t have = got - header_len;
+
+        if (*type && have <= sz) {
+            data = malloc(sz + 1);
+            if (!data) {
+                perror("malloc");
+                exit(1);
+            }
+            memcpy(data, header + header_len, have);
+            if (rc != Z_STREAM_END) {
+                z->next_out = data + have;
+                z->avail_out = (unsigned)(sz + 1 - have);
+                rc = inflate(z, Z_FINISH);
+            }
+            if (rc == Z_STREAM_END && z->total_out == header_len + sz) {
+                data[sz] = '\0';
+                *size = sz;
+                r->objects++;
+            } else {
+                free(data);
+                data = NULL;
+            }
+        }
+    }
+    munmap(src, (size_t)st.st_size);
+    return data;
+}
+
+
+// Reads any object by hash, packed or loose; NULL if missing or corrupt
+unsigned char *git_read_object(GitReader *r, const unsigned char *hash, int *type, size_t *size) {
+    const GitPack *pack;
+    uint64_t offset;
+    if (git_find_packed(hash, &pack, &offset) == 0)
+        return git_read_packed(r, pack, offset, type, size);
+    return git_read_loose(r, hash, type, size);
+}
+
+
+// Inflates a zlib stream a buffer at a time, feeding the content to 'scan'
+// and dropping a loose object's "type size\0" header first if asked to
+int git_inflate_scan(GitReader *r, const unsigned char *src, size_t src_len, int skip_header,
+                     unsigned char *buf, LineScan *scan) {
+    z_stream *z = &r->z;
+    inflateReset(z);
+    z->next_in = (unsigned char *)src;
+    z->avail_in = src_len > UINT_MAX ? UINT_MAX : (unsigned)src_len;
+    int rc;
+    do {
+        z->next_out = buf;
+        z->avail_out = READ_BUFFER_SIZE;
+        rc = inflate(z, Z_NO_FLUSH);
+        if (rc != Z_OK && rc != Z_STREAM_END) return -1;
+        size_t got = READ_BUFFER_SIZE - z->avail_out;
+        if (rc == Z_OK && got == 0) return -1;  // Truncated stream
+        unsigned char *p = buf;
+        if (skip_header) {
+            unsigned char *nul = memchr(p, '\0', got);
+            if (!nul) return -1;
+            got -= (size_t)(nul + 1 - p);
+            p = nul + 1;
+            skip_header = 0;
+        }
+        scan_block(scan, p, got);
+    } while (rc != Z_STREAM_END);
+    r->objects++;
+    return 0;
+}
+
+
+// Counts the lines of a blob. Stored (non-delta) blobs are streamed
+// through the worker's read buffer; deltas have to be rebuilt in memory.
+int git_count_blob(GitReader *r, const unsigned char *hash, unsigned char *buf, LineScan *scan) {
+    const GitPack *pack;
+    uint64_t offset;
+    if (git_find_packed(hash, &pack, &offset) == 0) {
+        int type;
+        size_t size;
+        const unsigned char *payload, *base_hash;
+        uint64_t base_offset;
+        if (git_pack_entry(pack, offset, &type, &size, &payload, &base_offset, &base_hash) != 0)
+            return -1;
+        if (type == GIT_OBJ_BLOB)
+            return git_inflate_scan(r, payload, pack->data_size - (size_t)(payload - pack->data),
+                                    0, buf, scan);
+        unsigned char *data = git_read_packed(r, pack, offset, &type, &size);
+        if (!data || type != GIT_OBJ_BLOB) {
+            free(data);
+            return -1;
+        }
+        scan_block(scan, data, size);
+        free(data);
+        return 0;
+    }
+
+    char hex[2 * GIT_MAX_HASH + 1], path[PATH_MAX + 2 * GIT_MAX_HASH + 16];
+    git_hex(hash, hex);
+    snprintf(path, sizeof(path), "%s/objects/%.2s/%s", git_common_dir, hex, hex + 2);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+    void *src = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (src == MAP_FAILED) return -1;
+    int rc = git_inflate_scan(r, src, (size_t)st.st_size, 1, buf, scan);
+    munmap(src, (size_t)st.st_size);
+    return rc;
+}
+
+
+// Reads a ref (e.g. "HEAD", "refs/heads/main") from its loose file or from
+// packed-refs, following symbolic refs
+int git_read_ref(const char *name, unsigned char *hash, int depth) {
+    if (depth > 8) return -1;
+
+    char path[PATH_MAX * 2], line[PATH_MAX + 64];
+    const char *dirs[2] = {git_private_dir, git_common_dir};
+    for (int i = 0; i < 2; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dirs[i], name);
+        FILE *f = fopen(path, "r");
+        if (!f) continue;
+        int ok = fgets(line, sizeof(line), f) != NULL;
+        fclose(f);
+        if (!ok) continue;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (strncmp(line, "ref: ", 5) == 0) return git_read_ref(line + 5, hash, depth + 1);
+        if ((int)strlen(line) == 2 * git_hash_len && git_parse_hex(line, 2 * git_hash_len, hash) == 0)
+            return 0;
+    }
+
+    // "<hex> <refname>" lines; "^<hex>" lines peel the tag above them
+    snprintf(path, sizeof(path), "%s/packed-refs", git_common_dir);
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    int found = -1;
+    size_t name_len = strlen(name);
+    while (found != 0 && fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        size_t hex_len = 2 * (size_t)git_hash_len;
+        if (strlen(line) == hex_len + 1 + name_len && line[hex_len] == ' ' &&
+            strcmp(line + hex_len + 1, name) == 0)
+            found = git_parse_hex(line, (int)hex_len, hash);
+    }
+    fclose(f);
+    return found;
+}
+
+
+// Resolves an abbreviated hash against the packs and loose objects
+// Returns 0 if exactly one object matches
+int git_resolve_prefix(const char *hex, int digits, unsigned char *hash) {
+    unsigned char want[GIT_MAX_HASH], match[GIT_MAX_HASH];
+    if (git_parse_hex(hex, digits, want) != 0) return -1;
+    int matches = 0;
+
+    for (int k = 0; k < git_pack_count; k++) {
+        const GitPack *p = &git_packs[k];
+        for (uint32_t i = git_pack_lower_bound(p, want); i < p->count; i++) {
+            const unsigned char *h = p->idx + 8 + 1024 + (size_t)i * git_hash_len;
+            char h_hex[2 * GIT_MAX_HASH + 1];
+            git_hex(h, h_hex);
+            if (strncasecmp(h_hex, hex, (size_t)digits) != 0) break;
+            if (matches == 0 || memcmp(match, h, (size_t)git_hash_len) != 0) matches++;
+            memcpy(match, h, (size_t)git_hash_len);
+        }
+    }
+
+    char path[PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s/objects/%.2s", git_common_dir, hex);
+    DIR *dir = opendir(path);
+    if (dir) {
+        struct dirent *entry;
+        while ((entry = readdir(dir))) {
+            if ((int)strlen(entry->d_name) != 2 * git_hash_len - 2 ||
+                strncasecmp(entry->d_name, hex + 2, (size_t)digits - 2) != 0)
+                continue;
+            unsigned char h[GIT_MAX_HASH];
+            char full[2 + sizeof(entry->d_name)];
+            snprintf(full, sizeof(full), "%.2s%s", hex, entry->d_name);
+            if (git_parse_hex(full, 2 * git_hash_len, h) != 0) continue;
+            if (matches == 0 || memcmp(match, h, (size_t)git_hash_len) != 0) matches++;
+            memcpy(match, h, (size_t)git_hash_len);
+        }
+        closedir(dir);
+    }
+
+    if (matches != 1) return -1;
+    memcpy(hash, match, (size_t)git_hash_len);
+    return 0;
+}
+
+
+// Reads a commit's tree and, if 'nth' > 0, its nth parent; 'when' (if not
+// NULL) gets the committer time shifted into the committer's time zone
+// Returns the number of parents, or -1 if 'hash' is not a readable commit
+int git_read_commit(GitReader *r, const unsigned char *hash, unsigned char *tree,
+                    unsigned char *parent, int nth, int64_t *when) {
+    int type;
+    size_t size;
+    char *text = (char *)git_read_object(r, hash, &type, &size);
+    if (!text || type != GIT_OBJ_COMMIT) {
+        free(text);
+        return -1;
+    }
+
+    int parents = 0, have_tree = 0;
+    int hex_len = 2 * git_hash_len;
+    if (when) *when = 0;
+    for (char *line = text; *line && *line != '\n'; line = strchr(line, '\n') + 1) {
+        if (strncmp(line, "tree ", 5) == 0) {
+            have_tree = git_parse_hex(line + 5, hex_len, tree) == 0;
+        } else if (strncmp(line, "parent ", 7) == 0) {
+            if (++parents == nth && parent) git_parse_hex(line + 7, hex_len, parent);
+        } else if (when && strncmp(line, "committer ", 10) == 0) {
+            // "committer Name <email> 1700000000 +0100"
+            const char *gt = NULL;
+            for (const char *p = line; *p && *p != '\n'; p++)
+                if (*p == '>') gt = p;
+            long long secs;
+            char sign;
+            int hours, minutes;
+            if (gt && sscanf(gt + 1, " %lld %c%2d%2d", &secs, &sign, &hours, &minutes) == 4)
+                *when = secs + (sign == '-' ? -1 : 1) * (hours * 3600 + minutes * 60);
+        }
+        if (!strchr(line, '\n')) break;
+    }
+    free(text);
+    return have_tree ? parents : -1;
+}
+
+
+// Follows annotated tags until 'hash' names a commit
+int git_peel_commit(GitReader *r, unsigned char *hash) {
+    for (int depth = 0; depth < 16; depth++) {
+        int type;
+        size_t size;
+        char *text = (char *)git_read_object(r, hash, &type, &size);
+        if (!text) return -1;
+        int rc = -1;
+        if (type == GIT_OBJ_COMMIT) {
+            free(text);
+            return 0;
+        }
+        if (type == GIT_OBJ_TAG && strncmp(text, "object ", 7) == 0)
+            rc = git_parse_hex(text + 7, 2 * git_hash_len, hash);
+        free(text);
+        if (rc != 0) return -1;
+    }
+    return -1;
+}
+
+
+// Resolves a revision to a commit: a full or abbreviated hash, HEAD, or a
+// branch, tag or remote name (looked up as git does), optionally followed
+// by any number of "~N" (Nth first-parent ancestor) and "^N" (Nth parent)
+int git_resolve_rev(GitReader *r, const char *spec, unsigned char *commit) {
+    size_t base_len = strcspn(spec, "~^");
+    char name[PATH_MAX];
+    if (base_len == 0 || base_len >= sizeof(name)) return -1;
+    memcpy(name, spec, base_len);
+    name[base_len] = '\0';
+
+    static const char *const patterns[] = {
+        "%s", "refs/%s", "refs/tags/%s", "refs/heads/%s", "refs/remotes/%s", "refs/remotes/%s/HEAD"
+    };
+    int found = -1;
+    int all_hex = strspn(name, "0123456789abcdefABCDEF") == base_len;
+    if (all_hex && (int)base_len == 2 * git_hash_len)
+        found = git_parse_hex(name, (int)base_len, commit);
+    for (size_t i = 0; found != 0 && i < sizeof(patterns) / sizeof(*patterns); i++) {
+        char ref[PATH_MAX + 32];
+        snprintf(ref, sizeof(ref), patterns[i], name);
+        found = git_read_ref(ref, commit, 0);
+    }
+    if (found != 0 && all_hex && base_len >= 4 && (int)base_len < 2 * git_hash_len)
+        found = git_resolve_prefix(name, (int)base_len, commit);
+    if (found != 0 || git_peel_commit(r, commit) != 0) return -1;
+
+    // Ancestry suffixes, applied left to right
+    const char *p = spec + base_len;
+    while (*p) {
+        char op = *p++;
+        if (op != '~' && op != '^') return -1;
+        char *end;
+        long n = strtol(p, &end, 10);
+        if (end == p) n = 1;
+        p = end;
+        if (n < 0) return -1;
+        unsigned char tree[GIT_MAX_HASH];
+        if (op == '^') {
+            if (n > 0 && git_read_commit(r, commit, tree, commit, (int)n, NULL) < n) return -1;
+        } else {
+            for (long i = 0; i < n; i++)
+                if (git_read_commit(r, commit, tree, commit, 1, NULL) < 1) return -1;
+        }
+    }
+    return 0;
+}
+
+
+// Steps through the entries of a tree object: "<octal mode> <name>\0<hash>"
+// Returns the position after the entry, or NULL at the end (or on garbage)
+const unsigned char *git_tree_next(const unsigned char *p, const unsigned char *end,
+                                   unsigned *mode, const char **name, const unsigned char **hash) {
+    if (p >= end) return NULL;
+    unsigned m = 0;
+    while (p < end && *p >= '0' && *p <= '7') m = m * 8 + (unsigned)(*p++ - '0');
+    if (p == end || *p++ != ' ') return NULL;
+    const unsigned char *nul = memchr(p, '\0', (size_t)(end - p));
+    if (!nul || (size_t)(end - nul - 1) < (size_t)git_hash_len) return NULL;
+    *mode = m;
+    *name = (const char *)p;
+    *hash = nul + 1;
+    return nul + 1 + git_hash_len;
+}
+
+
+// Finds the memo entry of a blob, adding it (and queueing it for counting)
+// if this run has not seen it yet. A blob is classified by the extension of
+// the first path it turns up under.
+size_t blob_lookup(const unsigned char *hash, int ext) {
+    if (2 * (blob_count + 1) > blob_table_cap) {
+        // Grow the table and reinsert every blob
+        size_t cap = blob_table_cap ? 2 * blob_table_cap : 4096;
+        uint32_t *table = malloc(cap * sizeof(*table));
+        if (!table) {
+            perror("malloc");
+            exit(1);
+        }
+        memset(table, 0xff, cap * sizeof(*table));
+        for (size_t i = 0; i < blob_count; i++) {
+            uint64_t key;
+            memcpy(&key, blob_counts[i].hash, sizeof(key));
+            size_t slot = key & (cap - 1);
+            while (table[slot] != UINT32_MAX) slot = (slot + 1) & (cap - 1);
+            table[slot] = (uint32_t)i;
+        }
+        free(blob_table);
+        blob_table = table;
+        blob_table_cap = cap;
+    }
+
+    uint64_t key;
+    memcpy(&key, hash, sizeof(key));  // Hashes are already uniformly spread
+    size_t slot = key & (blob_table_cap - 1);
+    for (; blob_table[slot] != UINT32_MAX; slot = (slot + 1) & (blob_table_cap - 1))
+        if (memcmp(blob_counts[blob_table[slot]].hash, hash, (size_t)git_hash_len) == 0)
+            return blob_table[slot];
+
+    if (blob_count == blob_counts_cap) {
+        blob_counts_cap = blob_counts_cap ? 2 * blob_counts_cap : 1024;
+        blob_counts = realloc(blob_counts, blob_counts_cap * sizeof(*blob_counts));
+    }
+    if (blob_todo_count == blob_todo_cap) {
+        blob_todo_cap = blob_todo_cap ? 2 * blob_todo_cap : 1024;
+        blob_todo = realloc(blob_todo, blob_todo_cap * sizeof(*blob_todo));
+    }
+    if (!blob_counts || !blob_todo) {
+        perror("realloc");
+        exit(1);
+    }
+    memcpy(blob_counts[blob_count].hash, hash, (size_t)git_hash_len);
+    blob_counts[blob_count].lines = -1;
+    blob_counts[blob_count].ext = ext;
+    blob_table[slot] = (uint32_t)blob_count;
+    blob_todo[blob_todo_count++] = blob_count;
+    return blob_count++;
+}
+
+
+// Lists a file of the revision along with its blob
+void rev_list_file(const char *path, size_t len, const unsigned char *blob, int ext) {
+    if (listed_count == listed_blobs_cap) {
+        listed_blobs_cap = listed_blobs_cap ? 2 * listed_blobs_cap : 1024;
+        listed_blobs = realloc(listed_blobs, listed_blobs_cap * sizeof(*listed_blobs));
+        if (!listed_blobs) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    listed_blobs[listed_count] = blob_lookup(blob, ext);
+    list_file(path, len, ext);
+}
+
+
+// Lists the matching files below a tree, in tree order. 'path' holds the
+// tree's path ("" or ending in '/') and 'exclude_state' its exclude state.
+void rev_collect(GitReader *r, const unsigned char *tree, PathBuf *path, int32_t exclude_state) {
+    int type;
+    size_t size;
+    unsigned char *data = git_read_object(r, tree, &type, &size);
+    if (!data || type != GIT_OBJ_TREE) {
+        char hex[2 * GIT_MAX_HASH + 1];
+        git_hex(tree, hex);
+        fprintf(stderr, "linebolt: cannot read tree %s (%s)\n", hex, path->len ? path->data : ".");
+        git_read_failed = 1;
+        free(data);
+        return;
+    }
+
+    size_t base_len = path->len;
+    unsigned mode;
+    const char *name;
+    const unsigned char *hash;
+    for (const unsigned char *p = data; (p = git_tree_next(p, data + size, &mode, &name, &hash));) {
+        size_t name_len = strlen(name);
+        if ((mode & S_IFMT) == S_IFDIR) {
+            int32_t state = exclude_dir_state(exclude_state, name);
+            if (state < 0) continue;
+            pathbuf_reserve(path, base_len + name_len + 2);
+            memcpy(path->data + base_len, name, name_len);
+            path->data[base_len + name_len] = '/';
+            path->data[base_len + name_len + 1] = '\0';
+            path->len = base_len + name_len + 1;
+            rev_collect(r, hash, path, state);
+            path->len = base_len;
+            path->data[base_len] = '\0';
+        } else if ((mode & S_IFMT) == S_IFREG) {
+            int ext = match_extension(name);
+            if (ext < 0) continue;
+            pathbuf_reserve(path, base_len + name_len + 1);
+            memcpy(path->data + base_len, name, name_len + 1);
+            rev_list_file(path->data, base_len + name_len, hash, ext);
+            path->data[base_len] = '\0';
+        }
+    }
+    free(data);
+}
+
+
+// Worker loop for --rev: claim a batch of blobs to count, repeat
+void *rev_worker_main(void *arg) {
+    Worker *w = arg;
+    for (;;) {
+        size_t first = __atomic_fetch_add(&blob_cursor, BLOB_BATCH, __ATOMIC_RELAXED);
+        if (first >= blob_todo_count) break;
+        size_t last = first + BLOB_BATCH < blob_todo_count ? first + BLOB_BATCH : blob_todo_count;
+        for (size_t i = first; i < last; i++) {
+            BlobCount *blob = &blob_counts[blob_todo[i]];
+            LineScan scan;
+            scan_start(&scan, blob->ext);
+            w->stats.blobs++;
+            if (git_count_blob(w->git, blob->hash, w->read_buf, &scan) != 0) {
+                // Stays uncounted: no path or commit gets a partial count
+                char hex[2 * GIT_MAX_HASH + 1];
+                git_hex(blob->hash, hex);
+                fprintf(stderr, "linebolt: cannot read blob %s\n", hex);
+                __atomic_store_n(&git_read_failed, 1, __ATOMIC_RELAXED);
+                continue;
+            }
+            blob->lines = scan_finish(&scan);
+            blob->bytes = scan.bytes;
+            blob->kinds = scan_kinds(&scan);
+        }
+    }
+    return NULL;
+}
+
+
+// Opens the repository around 'start_path' and gives every worker an object
+// reader. '*subdir' gets the start directory relative to the top ("" at the
+// top); the caller frees it.
+int git_start(const char *start_path, char **subdir) {
+    char *real;
+    size_t top_len;
+    *subdir = NULL;
+    if (git_open_repo(start_path, &real, &top_len) != 0) {
+        free(real);
+        return -1;
+    }
+    const char *rest = real + top_len;
+    while (*rest == '/') rest++;
+    *subdir = strdup(rest);
+    free(real);
+    if (!*subdir) {
+        perror("strdup");
+        return -1;
+    }
+
+    // Blobs are memoized by hash instead of by inode
+    cache_path = NULL;
+    if (create_workers() != 0) return -1;
+    for (int i = 0; i < worker_count; i++) {
+        workers[i].git = calloc(1, sizeof(GitReader));
+        if (!workers[i].git || inflateInit(&workers[i].git->z) != Z_OK) {
+            fprintf(stderr, "linebolt: cannot set up zlib\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+// Replaces 'tree' by its subtree at the relative directory path 'subdir'
+// Returns -1 if there is no such directory
+int git_subtree(GitReader *r, unsigned char *tree, const char *subdir) {
+    char name[PATH_MAX];
+    const char *rest = subdir;
+    while (*rest) {
+        size_t len = strcspn(rest, "/");
+        memcpy(name, rest, len);
+        name[len] = '\0';
+        rest += len;
+        while (*rest == '/') rest++;
+
+        int type, found = 0;
+        size_t size;
+        unsigned char *data = git_read_object(r, tree, &type, &size);
+        unsigned mode;
+        const char *entry;
+        const unsigned char *hash;
+        for (const unsigned char *p = data; data && (p = git_tree_next(p, data + size, &mode, &entry, &hash));) {
+            if ((mode & S_IFMT) == S_IFDIR && strcmp(entry, name) == 0) {
+                memcpy(tree, hash, (size_t)git_hash_len);
+                found = 1;
+                break;
+            }
+        }
+        free(data);
+        if (!found) return -1;
+    }
+    return 0;
+}
+
+
+// Moves the readers' counters into the stats, frees the readers and
+// finishes the run
+void git_finish(long *total_lines) {
+    for (int i = 0; i < worker_count; i++) {
+        GitReader *reader = workers[i].git;
+        workers[i].stats.objects += reader->objects;
+        for (int k = 0; k < GIT_BASE_CACHE_SLOTS; k++) free(reader->cache[k].data);
+        inflateEnd(&reader->z);
+        free(reader);
+        workers[i].git = NULL;
+    }
+    finish_workers(total_lines);
+}
+
+
+// Counts the files below 'start_path' as of revision 'spec'
+int count_git_rev(const char *start_path, const char *spec, long *total_lines) {
+    char *subdir;
+    if (git_start(start_path, &subdir) != 0) {
+        free(subdir);
+        return -1;
+    }
+    GitReader *r = workers[0].git;
+
+    unsigned char commit[GIT_MAX_HASH], tree[GIT_MAX_HASH];
+    if (git_resolve_rev(r, spec, commit) != 0 || git_read_commit(r, commit, tree, NULL, 0, NULL) < 0) {
+        fprintf(stderr, "linebolt: unknown revision '%s'\n", spec);
+        free(subdir);
+        return -1;
+    }
+
+    // Started below the top: descend to the same directory in the revision
+    if (git_subtree(r, tree, subdir) != 0) {
+        fprintf(stderr, "linebolt: '%s' does not exist in '%s'\n", subdir, spec);
+        free(subdir);
+        return -1;
+    }
+    free(subdir);
+
+    PathBuf path = {0};
+    pathbuf_reserve(&path, 1);
+    path.data[0] = '\0';
+    rev_collect(r, tree, &path, GLOB_START);
+    free(path.data);
+
+    run_workers(rev_worker_main);
+
+    // Report in tree order from one thread
+    Worker *w = &workers[0];
+    for (size_t i = 0; i < listed_count; i++) {
+        w->stats.files++;
+        const BlobCount *blob = &blob_counts[listed_blobs[i]];
+        if (blob->lines < 0) continue;  // Could not be read
+        // Identical contents are the same blob: its id stands in for the hash
+        uint64_t content_hash = 0;
+        if (dedup_files) {
+            memcpy(&content_hash, blob->hash, sizeof(content_hash));
+            if (content_hash == 0) content_hash = 1;
+        }
+        report_file(w, listed_names + listed_paths[i], listed_exts[i], blob->lines, blob->bytes,
+                    classify_lines ? &blob->kinds : NULL, content_hash);
+    }
+    out_flush(&w->out, NULL, 0);
+    if (dir_rollups) {
+        listed_rollup_init();
+        for (size_t i = 0; i < listed_count; i++) {
+            listed_lines[i] = blob_counts[listed_blobs[i]].lines;
+            listed_bytes[i] = blob_counts[listed_blobs[i]].bytes;
+        }
+        rollup_listed(w);
+    }
+
+    git_finish(total_lines);
+    return git_read_failed ? 1 : 0;
+}
+
+
+// ---------------------------------------------------------------------------
+// History (--history)
+//
+// Neighbouring commits share almost all of their trees and blobs, so a
+// history run never looks at the same object twice. Every (tree, exclude
+// state) pair seen is summarized once as the matching blobs directly in it
+// plus its surviving subtrees; a subtree whose hash did not change since an
+// earlier commit is a memo hit and is not even read. The distinct blobs are
+// then counted in parallel exactly as for --rev, and each summary's
+// per-extension totals are added up once and shared by every commit that
+// contains it. The cost follows the number of distinct trees and blobs,
+// not commits times files.
+// ---------------------------------------------------------------------------
+
+// One entry of a tree summary: a matching blob or a subtree
+typedef struct {
+    uint32_t index;              // Into 'blob_counts', or 'tree_summaries' for a subtree
+    int32_t ext;                 // Extension of the blob's name; -1 for a subtree
+} TreeItem;
+
+typedef struct {
+    unsigned char hash[GIT_MAX_HASH];
+    int32_t exclude_state;
+    int summed;                  // Row of 'tree_totals' is filled in
+    size_t first_item;           // Range in 'tree_items'
+    size_t item_count;
+} TreeSummary;
+
+// One commit of the range, newest first
+typedef struct {
+    unsigned char hash[GIT_MAX_HASH];
+    unsigned char tree[GIT_MAX_HASH];
+    int64_t when;                // Committer time in the committer's time zone
+    uint32_t summary;            // UINT32_MAX if the start directory is missing
+} HistoryCommit;
+
+static TreeSummary *tree_summaries;
+static size_t tree_summary_count, tree_summaries_cap;
+static uint32_t *tree_table;     // Open addressing over 'tree_summaries', UINT32_MAX = empty
+static size_t tree_table_cap;
+static TreeItem *tree_items;
+static size_t tree_item_count, tree_items_cap;
+static long *tree_totals;        // Summaries x extensions
+
+
+// Finds the table slot of (hash, exclude state): its summary, or the empty
+// slot where it belongs
+uint32_t *tree_slot(const unsigned char *hash, int32_t exclude_state) {
+    uint64_t key;
+    memcpy(&key, hash, sizeof(key));
+    key ^= (uint64_t)(uint32_t)exclude_state * 0x9e3779b97f4a7c15ull;
+    size_t slot = key & (tree_table_cap - 1);
+    for (; tree_table[slot] != UINT32_MAX; slot = (slot + 1) & (tree_table_cap - 1)) {
+        const TreeSummary *s = &tree_summaries[tree_table[slot]];
+        if (s->exclude_state == exclude_state && memcmp(s->hash, hash, (size_t)git_hash_len) == 0)
+            break;
+    }
+    return &tree_table[slot];
+}
+
+
+// Adds a summary whose items are the last 'item_count' of 'tree_items'
+uint32_t tree_insert(const unsigned char *hash, int32_t exclude_state, size_t item_count) {
+    if (2 * (tree_summary_count + 1) > tree_table_cap) {
+        // Grow the table and reinsert every summary
+        free(tree_table);
+        tree_table_cap = tree_table_cap ? 2 * tree_table_cap : 1024;
+        tree_table = malloc(tree_table_cap * sizeof(*tree_table));
+        if (!tree_table) {
+            perror("malloc");
+            exit(1);
+        }
+        memset(tree_table, 0xff, tree_table_cap * sizeof(*tree_table));
+        for (size_t i = 0; i < tree_summary_count; i++)
+            *tree_slot(tree_summaries[i].hash, tree_summaries[i].exclude_state) = (uint32_t)i;
+    }
+    if (tree_summary_count == tree_summaries_cap) {
+        tree_summaries_cap = tree_summaries_cap ? 2 * tree_summaries_cap : 256;
+        tree_summaries = realloc(tree_summaries, tree_summaries_cap * sizeof(*tree_summaries));
+        if (!tree_summaries) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+
+    TreeSummary *s = &tree_summaries[tree_summary_count];
+    memcpy(s->hash, hash, (size_t)git_hash_len);
+    s->exclude_state = exclude_state;
+    s->summed = 0;
+    s->first_item = tree_item_count - item_count;
+    s->item_count = item_count;
+    *tree_slot(hash, exclude_state) = (uint32_t)tree_summary_count;
+    return (uint32_t)tree_summary_count++;
+}
+
+
+void tree_add_item(uint32_t index, int32_t ext) {
+    if (tree_item_count == tree_items_cap) {
+        tree_items_cap = tree_items_cap ? 2 * tree_items_cap : 4096;
+        tree_items = realloc(tree_items, tree_items_cap * sizeof(*tree_items));
+        if (!tree_items) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    tree_items[tree_item_count++] = (TreeItem){index, ext};
+}
+
+
+// Returns the summary of 'tree' under 'exclude_state', reading the tree and
+// summarizing any subtrees not seen before. New blobs are queued for counting.
+uint32_t tree_summarize(GitReader *r, const unsigned char *tree, int32_t exclude_state) {
+    if (tree_table_cap) {
+        uint32_t found = *tree_slot(tree, exclude_state);
+        if (found != UINT32_MAX) return found;
+    }
+
+    int type;
+    size_t size;
+    unsigned char *data = git_read_object(r, tree, &type, &size);
+    if (!data || type != GIT_OBJ_TREE) {
+        char hex[2 * GIT_MAX_HASH + 1];
+        git_hex(tree, hex);
+        fprintf(stderr, "linebolt: cannot read tree %s\n", hex);
+        git_read_failed = 1;
+        free(data);
+        return tree_insert(tree, exclude_state, 0);
+    }
+
+    // Subtrees first, so that this tree's own items end up contiguous
+    unsigned mode;
+    const char *name;
+    const unsigned char *hash;
+    for (const unsigned char *p = data; (p = git_tree_next(p, data + size, &mode, &name, &hash));) {
+        if ((mode & S_IFMT) != S_IFDIR) continue;
+        int32_t state = exclude_dir_state(exclude_state, name);
+        if (state >= 0) tree_summarize(r, hash, state);
+    }
+
+    size_t first = tree_item_count;
+    for (const unsigned char *p = data; (p = git_tree_next(p, data + size, &mode, &name, &hash));) {
+        if ((mode & S_IFMT) == S_IFDIR) {
+            int32_t state = exclude_dir_state(exclude_state, name);
+            if (state >= 0) tree_add_item(*tree_slot(hash, state), -1);
+        } else if ((mode & S_IFMT) == S_IFREG) {
+            int ext = match_extension(name);
+            if (ext >= 0) tree_add_item((uint32_t)blob_lookup(hash, ext), ext);
+        }
+    }
+    free(data);
+    return tree_insert(tree, exclude_state, tree_item_count - first);
+}
+
+
+// Returns the per-extension line totals below a summary, adding them up on
+// first use (after the blobs have been counted)
+const long *tree_sum(uint32_t index) {
+    long *row = tree_totals + (size_t)index * (size_t)ext_matcher.count;
+    if (tree_summaries[index].summed) return row;
+
+    const TreeItem *item = tree_items + tree_summaries[index].first_item;
+    for (size_t i = 0; i < tree_summaries[index].item_count; i++, item++) {
+        if (item->ext >= 0) {
+            // An unreadable blob adds nothing
+            if (blob_counts[item->index].lines > 0) row[item->ext] += blob_counts[item->index].lines;
+        } else {
+            const long *child = tree_sum(item->index);
+            for (int e = 0; e < ext_matcher.count; e++) row[e] += child[e];
+        }
+    }
+    tree_summaries[index].summed = 1;
+    return row;
+}
+
+
+// Reports the lines below 'start_path' for every commit in 'range': "A..B"
+// follows first parents from B back to (not including) A, a single
+// revision back to the root commit. A range whose A is not on B's
+// first-parent chain (reversed, on a merged branch, unrelated) is refused. Commits are printed oldest first;
+// '*total_lines' gets the newest commit's total.
+int count_git_history(const char *start_path, const char *range, long *total_lines) {
+    char *subdir;
+    if (git_start(start_path, &subdir) != 0) {
+        free(subdir);
+        return -1;
+    }
+    GitReader *r = workers[0].git;
+
+    // Split the range, defaulting either side of ".." to HEAD like git
+    char from[PATH_MAX], to[PATH_MAX];
+    const char *dots = strstr(range, "..");
+    size_t from_len = dots ? (size_t)(dots - range) : 0;
+    const char *to_spec = dots ? dots + 2 : range;
+    if (from_len >= sizeof(from) || strlen(to_spec) >= sizeof(to)) {
+        fprintf(stderr, "linebolt: bad range '%s'\n", range);
+        free(subdir);
+        return -1;
+    }
+    snprintf(from, sizeof(from), "%.*s", (int)from_len, from_len ? range : "HEAD");
+    snprintf(to, sizeof(to), "%s", *to_spec ? to_spec : "HEAD");
+
+    unsigned char commit[GIT_MAX_HASH], stop[GIT_MAX_HASH];
+    if (git_resolve_rev(r, to, commit) != 0) {
+        fprintf(stderr, "linebolt: unknown revision '%s'\n", to);
+        free(subdir);
+        return -1;
+    }
+    if (dots && git_resolve_rev(r, from, stop) != 0) {
+        fprintf(stderr, "linebolt: unknown revision '%s'\n", from);
+        free(subdir);
+        return -1;
+    }
+
+    // Walk the first-parent chain, newest first
+    HistoryCommit *commits = NULL;
+    size_t count = 0, cap = 0;
+    while (!dots || memcmp(commit, stop, (size_t)git_hash_len) != 0) {
+        if (count == cap) {
+            cap = cap ? 2 * cap : 64;
+            commits = realloc(commits, cap * sizeof(*commits));
+            if (!commits) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        HistoryCommit *c = &commits[count++];
+        memcpy(c->hash, commit, (size_t)git_hash_len);
+        int parents = git_read_commit(r, c->hash, c->tree, commit, 1, &c->when);
+        if (parents < 0) {
+            char hex[2 * GIT_MAX_HASH + 1];
+            git_hex(c->hash, hex);
+            fprintf(stderr, "linebolt: cannot read commit %s\n", hex);
+            free(commits);
+            free(subdir);
+            return -1;
+        }
+        if (parents == 0) {
+            if (dots) {
+                // Reached the root without meeting A
+                fprintf(stderr, "linebolt: '%s' is not a first-parent ancestor of '%s'\n", from, to);
+                free(commits);
+                free(subdir);
+                return -1;
+            }
+            break;
+        }
+    }
+
+    // Summarize every commit's tree (oldest first, which is the order the
+    // trees were built up in), queueing each distinct blob once
+    for (size_t i = count; i-- > 0;) {
+        unsigned char tree[GIT_MAX_HASH];
+        memcpy(tree, commits[i].tree, (size_t)git_hash_len);
+        commits[i].summary = git_subtree(r, tree, subdir) == 0
+            ? tree_summarize(r, tree, GLOB_START) : UINT32_MAX;
+    }
+    free(subdir);
+
+    run_workers(rev_worker_main);
+
+    tree_totals = calloc(tree_summary_count * (size_t)ext_matcher.count + 1, sizeof(*tree_totals));
+    if (!tree_totals) {
+        perror("calloc");
+        exit(1);
+    }
+    // A column per extension, or with --by-lang per language: each
+    // extension folds into the first extension of its language
+    int *column = malloc((size_t)ext_matcher.count * sizeof(*column));
+    long *row = malloc((size_t)ext_matcher.count * sizeof(*row));
+    if (!column || !row) {
+        perror("malloc");
+        exit(1);
+    }
+    printf("%-12s  %-10s  %12s", "Commit", "Date", "Lines");
+    for (int e = 0; e < ext_matcher.count; e++) {
+        column[e] = e;
+        for (int k = 0; breakdown == BREAKDOWN_LANG && k < e; k++) {
+            if (ext_language[k] == ext_language[e]) {
+                column[e] = k;
+                break;
+            }
+        }
+        if (column[e] != e) continue;
+        char label[64];
+        if (breakdown == BREAKDOWN_LANG)
+            snprintf(label, sizeof(label), "%s", language_name(e));
+        else
+            snprintf(label, sizeof(label), ".%s", ext_matcher.names[e]);
+        printf("  %12s", label);
+    }
+    printf("\n");
+
+    long newest = 0;
+    for (size_t i = count; i-- > 0;) {
+        const HistoryCommit *c = &commits[i];
+        const long *totals = c->summary != UINT32_MAX ? tree_sum(c->summary) : NULL;
+        long total = 0;
+        for (int e = 0; e < ext_matcher.count; e++) row[e] = 0;
+        for (int e = 0; totals && e < ext_matcher.count; e++) {
+            total += totals[e];
+            row[column[e]] += totals[e];
+        }
+
+        char hex[2 * GIT_MAX_HASH + 1], date[32];
+        git_hex(c->hash, hex);
+        time_t when = (time_t)c->when;
+        struct tm tm;
+        gmtime_r(&when, &tm);
+        strftime(date, sizeof(date), "%Y-%m-%d", &tm);
+        printf("%.12s  %-10s  %12ld", hex, date, total);
+        for (int e = 0; e < ext_matcher.count; e++)
+            if (column[e] == e) printf("  %12ld", row[e]);
+        printf("\n");
+        if (i == 0) newest = total;
+    }
+    free(commits);
+    free(column);
+    free(row);
+
+    git_finish(total_lines);
+    *total_lines = newest;
+    return git_read_failed ? 1 : 0;
+}
+
+#else
+
+int count_git_rev(const char *start_path, const char *spec, long *total_lines) {
+    (void)start_path;
+    (void)spec;
+    (void)total_lines;
+    fprintf(stderr, "linebolt: --rev needs zlib; rebuild with zlib installed and -lz\n");
+    return -1;
+}
+
+
+int count_git_history(const char *start_path, const char *range, long *total_lines) {
+    (void)start_path;
+    (void)range;
+    (void)total_lines;
+    fprintf(stderr, "linebolt: --history needs zlib; rebuild with zlib installed and -lz\n");
+    return -1;
+}
+
+#endif
+
+
+// Prints the command-line help to the given stream
+void usage(FILE *out) {
+    fprintf(out,
+        "Usage: linebolt [options] [path...]\n"
+        "\n"
+        "Counts lines in source files below the current directory, or below\n"
+        "each directory given and in each file given.\n"
+        "\n"
+        "Options:\n"
+        "  --ext=LIST             comma-separated extensions to count (default c,h);\n"
+        "                         multi-dot suffixes like d.ts are allowed\n"
+        "  --exclude-dir=GLOBS    comma-separated directory names or paths to skip,\n"
+        "                         e.g. node_modules,third_party/*,**/gen (repeatable)\n"
+        "  --no-default-excludes  do not skip %s\n"
+        "  --follow               follow symbolic links, cutting link loops\n"
+        "                         (default)\n"
+        "  --no-follow            skip symbolic links met during the walk\n"
+        "  --unique-inodes        walk and count each directory and file once,\n"
+        "                         however many hard or followed links reach it\n"
+        "  --gitignore            skip what .gitignore, .git/info/exclude and\n"
+        "                         .lineboltignore files exclude\n"
+        "  --git-index            count the files tracked in .git/index instead of\n"
+        "                         walking the directories (falls back to walking)\n"
+        "  --rev=REV              count the files of a commit, branch or tag (with\n"
+        "                         ~N / ^N suffixes) straight from the object store\n"
+        "  --history=RANGE        lines per commit (and per extension, or language\n"
+        "                         with --by-lang) for A..B or REV back to the\n"
+        "                         root, following first parents\n"
+        "  --classify             split each count into code, comment and blank\n"
+        "                         lines, by each extension's language\n"
+        "  --by-ext               files, lines and bytes per extension\n"
+        "  --by-lang              files, lines and bytes per language\n"
+        "  --dedup                also total the lines of byte-identical files\n"
+        "                         only once, like cloc\n"
+        "  --dirs                 recursive lines, files and bytes of every\n"
+        "                         directory instead of the per-file list\n"
+        "  --depth=N              with --dirs, list directories at most N levels\n"
+        "                         below the starting one (implies --dirs)\n"
+        "  --io=MODE              how file contents are read: read (default), mmap,\n"
+        "                         or uring (batched io_uring, Linux only)\n"
+        "  --mmap-threshold=BYTES files smaller than this are pread() instead of mapped\n"
+        "                         (default %d, at most %d)\n"
+        "  -j N, --jobs=N         worker threads (default: usable CPUs)\n"
+        "  --walkers=N            walk directories on N threads of their own and\n"
+        "                         queue the files for counting (default: -j / 4)\n"
+        "  --counters=N           count the queued files on N threads (default: -j)\n"
+        "  --split-size=BYTES     idle threads help count files of at least this size\n"
+        "                         (default %d; 0 never splits)\n"
+        "  --stats                print traversal instrumentation to stderr\n"
+        "  --cache=FILE           reuse counts of unchanged files from FILE and\n"
+        "                         write the updated cache back at exit\n"
+        "  -h, --help             show this help\n",
+        DEFAULT_EXCLUDES, DEFAULT_MMAP_THRESHOLD, READ_BUFFER_SIZE, DEFAULT_SPLIT_SIZE);
+}
+
+
+// Parses a non-negative decimal size argument; returns -1 if malformed
+long long parse_size(const char *text) {
+    char *end;
+    errno = 0;
+    long long value = strtoll(text, &end, 10);
+    if (errno || end == text || *end != '\0' || value < 0) return -1;
+    return value;
+}
+
+
+// Files and directories to count, from the command line; "." if none
+static const char **operands;
+static int operand_count;
+
+
+// Applies the command-line options to the global settings
+// Returns 0 on success, -1 after printing a diagnostic
+int parse_args(int argc, char **argv) {
+    const char *extensions = DEFAULT_EXTENSIONS;
+    int default_excludes = 1;
+    int options_done = 0;
+
+    operands = malloc((size_t)argc * sizeof(*operands));
+    if (!operands) {
+        perror("malloc");
+        return -1;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        char *arg = argv[i];
+
+        if (options_done || arg[0] != '-' || arg[1] == '\0') {
+            // A path: "src/" is shown as "src/a.c", not "src//a.c"
+            size_t len = strlen(arg);
+            while (len > 1 && arg[len - 1] == '/') arg[--len] = '\0';
+            operands[operand_count++] = arg;
+        } else if (strcmp(arg, "--") == 0) {
+            options_done = 1;
+        } else if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            usage(stdout);
+            exit(0);
+        } else if (strncmp(arg, "-j", 2) == 0 || strncmp(arg, "--jobs=", 7) == 0) {
+            // Accept "-j N", "-jN" and "--jobs=N"
+            const char *value = arg[1] == '-' ? arg + 7 : arg + 2;
+            if (*value == '\0') {
+                if (++i == argc) {
+                    fprintf(stderr, "linebolt: -j needs a thread count\n");
+                    return -1;
+                }
+                value = argv[i];
+            }
+            long long jobs = parse_size(value);
+            if (jobs < 1 || jobs > 4096) {
+                fprintf(stderr, "linebolt: invalid thread count '%s'\n", value);
+                return -1;
+            }
+            thread_count = (int)jobs;
+        } else if (strncmp(arg, "--ext=", 6) == 0) {
+            extensions = arg + 6;
+        } else if (strcmp(arg, "--ext") == 0) {
+            if (++i == argc) {
+                fprintf(stderr, "linebolt: --ext needs a list of extensions\n");
+                return -1;
+            }
+            extensions = argv[i];
+        } else if (strncmp(arg, "--exclude-dir=", 14) == 0) {
+            add_exclude_patterns(arg + 14);
+        } else if (strcmp(arg, "--exclude-dir") == 0) {
+            if (++i == argc) {
+                fprintf(stderr, "linebolt: --exclude-dir needs a pattern\n");
+                return -1;
+            }
+            add_exclude_patterns(argv[i]);
+        } else if (strcmp(arg, "--no-default-excludes") == 0) {
+            default_excludes = 0;
+        } else if (strcmp(arg, "--gitignore") == 0) {
+            use_ignore_files = 1;
+        } else if (strcmp(arg, "--git-index") == 0) {
+            use_git_index = 1;
+        } else if (strncmp(arg, "--rev=", 6) == 0 && arg[6] != '\0') {
+            rev_spec = arg + 6;
+        } else if (strcmp(arg, "--rev") == 0) {
+            if (++i == argc) {
+                fprintf(stderr, "linebolt: --rev needs a revision\n");
+                return -1;
+            }
+            rev_spec = argv[i];
+        } else if (strncmp(arg, "--history=", 10) == 0 && arg[10] != '\0') {
+            history_range = arg + 10;
+        } else if (strcmp(arg, "--history") == 0) {
+            if (++i == argc) {
+                fprintf(stderr, "linebolt: --history needs a revision range\n");
+                return -1;
+            }
+            history_range = argv[i];
+        } else if (strcmp(arg, "--classify") == 0) {
+            classify_lines = 1;
+        } else if (strcmp(arg, "--by-ext") == 0) {
+            breakdown = BREAKDOWN_EXT;
+        } else if (strcmp(arg, "--by-lang") == 0) {
+            breakdown = BREAKDOWN_LANG;
+        } else if (strcmp(arg, "--dedup") == 0) {
+            dedup_files = 1;
+        } else if (strcmp(arg, "--dirs") == 0) {
+            dir_rollups = 1;
+        } else if (strncmp(arg, "--depth=", 8) == 0 || strcmp(arg, "--depth") == 0) {
+            const char *value = arg + 7;
+            if (*value == '=') {
+                value++;
+            } else {
+                if (++i == argc) {
+                    fprintf(stderr, "linebolt: --depth needs a number\n");
+                    return -1;
+                }
+                value = argv[i];
+            }
+            long long depth = parse_size(value);
+            if (depth < 0 || depth > INT_MAX) {
+                fprintf(stderr, "linebolt: invalid depth '%s'\n", value);
+                return -1;
+            }
+            max_depth = (int)depth;
+            dir_rollups = 1;
+        } else if (strncmp(arg, "--walkers=", 10) == 0 || strncmp(arg, "--counters=", 11) == 0) {
+            int walkers = arg[2] == 'w';
+            const char *value = arg + (walkers ? 10 : 11);
+            long long threads = parse_size(value);
+            if (threads < 1 || threads > 4096) {
+                fprintf(stderr, "linebolt: invalid thread count '%s'\n", value);
+                return -1;
+            }
+            *(walkers ? &walker_threads : &counter_threads) = (int)threads;
+        } else if (strncmp(arg, "--split-size=", 13) == 0) {
+            long long value = parse_size(arg + 13);
+            if (value < 0) {
+                fprintf(stderr, "linebolt: invalid --split-size '%s'\n", arg + 13);
+                return -1;
+            }
+            split_size = (size_t)value;
+        } else if (strcmp(arg, "--follow") == 0) {
+            follow_links = 1;
+        } else if (strcmp(arg, "--no-follow") == 0) {
+            follow_links = 0;
+        } else if (strcmp(arg, "--unique-inodes") == 0) {
+            unique_inodes = 1;
+        } else if (strcmp(arg, "--stats") == 0) {
+            show_stats = 1;
+        } else if (strncmp(arg, "--cache=", 8) == 0 && arg[8] != '\0') {
+            cache_path = arg + 8;
+        } else if (strcmp(arg, "--io=read") == 0) {
+            io_mode = IO_READ;
+        } else if (strcmp(arg, "--io=mmap") == 0) {
+            io_mode = IO_MMAP;
+        } else if (strcmp(arg, "--io=uring") == 0) {
+#ifdef LINEBOLT_HAVE_URING
+            io_mode = IO_URING;
+#else
+            fprintf(stderr, "linebolt: --io=uring is only available on Linux\n");
+            return -1;
+#endif
+        } else if (strncmp(arg, "--mmap-threshold=", 17) == 0) {
+            long long value = parse_size(arg + 17);
+            if (value < 0 || value > READ_BUFFER_SIZE) {
+                fprintf(stderr, "linebolt: invalid --mmap-threshold '%s'\n", arg + 17);
+                return -1;
+            }
+            mmap_threshold = (size_t)value;
+        } else {
+            fprintf(stderr, "linebolt: unknown option '%s'\n", arg);
+            usage(stderr);
+            return -1;
+        }
+    }
+    if (compile_extensions(extensions) != 0)
+        return -1;
+    if (default_excludes) add_exclude_patterns(DEFAULT_EXCLUDES);
+    if (compile_excludes() != 0)
+        return -1;
+    if (classify_lines && cache_path) {
+        // Cache records hold plain line counts only
+        fprintf(stderr, "linebolt: --cache is ignored with --classify\n");
+        cache_path = NULL;
+    }
+    if (history_range && dir_rollups) {
+        fprintf(stderr, "linebolt: --dirs is ignored with --history\n");
+        dir_rollups = 0;
+    }
+    if (history_range && dedup_files) {
+        fprintf(stderr, "linebolt: --dedup is ignored with --history\n");
+        dedup_files = 0;
+    }
+    if (dedup_files) pair_set_init(&dedup_set);
+    assign_languages();
+    if (classify_lines) compile_languages();
+    return 0;
+}
+
+
+// Entry point of the program
+int main(int argc, char **argv) {
+    if (parse_args(argc, argv) != 0)
+        return 1;
+
+    // Record the start time using a monotonic (non-wall) clock
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long total_lines = 0;
+
+    // Pick the fastest newline counter this CPU supports
+    init_newline_kernel();
+
+
+    // Start recursive directory traversal from current directory (".") or
+    // the paths given; accumulate total line count in total_lines. With
+    // --git-index the index lists the files instead, unless it cannot be used
+    static const char *const current_dir[] = { "." };
+    const char *const *paths = operand_count ? operands : current_dir;
+    int path_count = operand_count ? operand_count : 1;
+    if (operand_count && (history_range || rev_spec || use_git_index)) {
+        fprintf(stderr, "linebolt: paths cannot be combined with --git-index, --rev or --history\n");
+        return 1;
+    }
+
+    int rc = -1;
+    if (history_range) {
+        rc = count_git_history(".", history_range, &total_lines);
+    } else if (rev_spec) {
+        rc = count_git_rev(".", rev_spec, &total_lines);
+    } else {
+        if (use_git_index) rc = count_git_index(".", &total_lines);
+        if (rc != 0) rc = walk_directory(paths, path_count, &total_lines);
+    }
+    if (rc >= 0) {
+        // If directory traversal succeeded (perhaps short of a named
+        // path, which was reported), print final result
+        if (run_by_ext && !history_range) print_breakdown();  // History rows have the columns
+        printf("\n=============================\n");
+        printf("Total lines: %ld\n", total_lines);
+        if (dedup_files)
+            printf("Unique lines: %ld (%ld duplicate files)\n", run_unique_lines, run_duplicate_files);
+        if (classify_lines && !history_range) {
+            printf("Code lines: %ld\n", run_kinds.code);
+            printf("Comment lines: %ld\n", run_kinds.comment);
+            printf("Blank lines: %ld\n", run_kinds.blank);
+        }
+    } else {
+        // If an error occurred, report it to stderr
+        fprintf(stderr, "Error walking the directory tree.\n");
+    }
+
+    // Record the end time after processing completes
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    // Compute elapsed time in milliseconds
+    double elapsed_ms = (end.tv_sec - start.tv_sec) * 1000.0 + \
+                    (end.tv_nsec - start.tv_nsec) / 1e6;
+
+    printf("\nExecution time: %.2f ms\n", elapsed_ms);
+
+    if (show_stats) {
+        fflush(stdout);  // Keep the report after the normal output on a terminal
+        print_stats(&run_stats);
+    }
 
-    return 0;  // Exit with success
+    // Exit with success only if everything asked for was counted
+    return rc == 0 ? 0 : 1;
 }
\ No newline at end of file